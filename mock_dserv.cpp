@@ -0,0 +1,298 @@
+// Minimal stand-in for the dataserver: accepts forwarder connections, parses
+// the '>' binary datapoint protocol and reports what arrived. Used by
+// `make bench` to measure the forwarder without a real dataserver.
+#include <iostream>
+#include <iomanip>
+#include <csignal>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define DPOINT_BINARY_MSG_CHAR '>'
+#define DPOINT_BINARY_FIXED_LENGTH 128
+#define DPOINT_HEADER_FIXED (1 + 2 + 8 + 4 + 4)
+
+volatile sig_atomic_t keepRunning = 1;
+
+void signalHandler(int) {
+    keepRunning = 0;
+}
+
+struct Connection {
+    int fd;
+    std::vector<char> buf;
+};
+
+struct Stats {
+    uint64_t messages;
+    uint64_t bytes;
+    std::map<std::string, uint64_t> per_point;
+    std::vector<int64_t> latencies_us;      // receive time - datapoint timestamp
+    uint64_t datagrams;
+    uint64_t datagrams_lost;                // sequence numbers never seen
+    uint32_t next_seq;
+
+    Stats() : messages(0), bytes(0), datagrams(0), datagrams_lost(0), next_seq(0) {}
+};
+
+uint64_t nowMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void recordMessage(const char* p, uint16_t varlen, size_t msglen, uint64_t received,
+                   bool verbose, Stats& stats) {
+    uint64_t timestamp;
+    uint32_t datatype, datalen;
+    memcpy(&timestamp, p + 3 + varlen, sizeof(timestamp));
+    memcpy(&datatype, p + 11 + varlen, sizeof(datatype));
+    memcpy(&datalen, p + 15 + varlen, sizeof(datalen));
+
+    std::string name(p + 3, varlen);
+    stats.messages++;
+    stats.bytes += msglen;
+    stats.per_point[name]++;
+    stats.latencies_us.push_back((int64_t)(received - timestamp));
+
+    if (verbose) {
+        std::cout << timestamp << " " << name << " type=" << datatype << " len=" << datalen;
+        if (datatype == 4) {            // DSERV_SHORT
+            const char* data = p + DPOINT_HEADER_FIXED + varlen;
+            for (uint32_t i = 0; i + 1 < datalen; i += 2) {
+                uint16_t v;
+                memcpy(&v, data + i, sizeof(v));
+                std::cout << " " << v;
+            }
+        }
+        std::cout << "\n";
+    }
+}
+
+// A forwarder --udp datagram: uint32 sequence number, then one compact message
+void parseDatagram(const char* p, size_t len, bool verbose, Stats& stats) {
+    uint32_t seq;
+    uint16_t varlen;
+    if (len < sizeof(seq) + DPOINT_HEADER_FIXED || p[sizeof(seq)] != DPOINT_BINARY_MSG_CHAR) {
+        std::cerr << "Malformed datagram of " << len << " bytes" << std::endl;
+        return;
+    }
+    memcpy(&seq, p, sizeof(seq));
+    memcpy(&varlen, p + sizeof(seq) + 1, sizeof(varlen));
+    if (len < sizeof(seq) + DPOINT_HEADER_FIXED + varlen) {
+        std::cerr << "Malformed datagram of " << len << " bytes" << std::endl;
+        return;
+    }
+    // Reordered or repeated datagrams are counted but not as losses
+    if (stats.datagrams > 0 && (int32_t)(seq - stats.next_seq) > 0) {
+        stats.datagrams_lost += seq - stats.next_seq;
+    }
+    if (stats.datagrams == 0 || (int32_t)(seq - stats.next_seq) >= 0) {
+        stats.next_seq = seq + 1;
+    }
+    stats.datagrams++;
+    recordMessage(p + sizeof(seq), varlen, len - sizeof(seq), nowMicros(), verbose, stats);
+}
+
+// Consume every complete message at the front of buf. Returns false on a
+// framing error.
+bool parseMessages(Connection& conn, bool compact, bool verbose, Stats& stats) {
+    size_t pos = 0;
+    uint64_t received = nowMicros();
+    while (conn.buf.size() - pos >= 3) {
+        const char* p = &conn.buf[pos];
+        if (p[0] != DPOINT_BINARY_MSG_CHAR) {
+            std::cerr << "Framing error: unexpected byte 0x" << std::hex
+                      << (int)(uint8_t)p[0] << std::dec << std::endl;
+            return false;
+        }
+        uint16_t varlen;
+        memcpy(&varlen, p + 1, sizeof(varlen));
+        size_t header = DPOINT_HEADER_FIXED + varlen;
+        if (conn.buf.size() - pos < header) break;
+
+        uint32_t datalen;
+        memcpy(&datalen, p + 15 + varlen, sizeof(datalen));
+
+        size_t msglen = compact ? header + datalen : DPOINT_BINARY_FIXED_LENGTH;
+        if (header + datalen > DPOINT_BINARY_FIXED_LENGTH && !compact) {
+            std::cerr << "Framing error: datapoint larger than " << DPOINT_BINARY_FIXED_LENGTH << " bytes" << std::endl;
+            return false;
+        }
+        if (conn.buf.size() - pos < msglen) break;
+
+        recordMessage(p, varlen, msglen, received, verbose, stats);
+        pos += msglen;
+    }
+    conn.buf.erase(conn.buf.begin(), conn.buf.begin() + pos);
+    return true;
+}
+
+void printSummary(Stats& stats, double seconds) {
+    std::cout << "Received " << stats.messages << " datapoints, " << stats.bytes << " bytes in "
+              << std::fixed << std::setprecision(1) << seconds << "s ("
+              << stats.messages / seconds << " msg/s, " << stats.bytes / seconds / 1024.0 << " KiB/s)\n";
+    for (auto& entry : stats.per_point) {
+        std::cout << "  " << std::left << std::setw(32) << entry.first << std::right
+                  << entry.second << " (" << entry.second / seconds << "/s)\n";
+    }
+    if (stats.datagrams > 0) {
+        std::cout << "  UDP: " << stats.datagrams << " datagrams, " << stats.datagrams_lost << " lost\n";
+    }
+    if (!stats.latencies_us.empty()) {
+        std::vector<int64_t>& l = stats.latencies_us;
+        std::sort(l.begin(), l.end());
+        auto pct = [&](double q) { return l[std::min(l.size() - 1, (size_t)(q * l.size()))]; };
+        std::cout << "  timestamp-to-receive latency: p50=" << pct(0.5) << "us p99=" << pct(0.99)
+                  << "us max=" << l.back() << "us\n";
+    }
+    std::cout.unsetf(std::ios::fixed);
+}
+
+void printUsage(const char* program_name) {
+    std::cout << "Usage: " << program_name << " [OPTIONS]\n"
+              << "Options:\n"
+              << "  -p, --port <port>       Port to listen on (default: 4620)\n"
+              << "  -d, --duration <s>      Exit after <s> seconds (default: run until Ctrl-C)\n"
+              << "  --compact               Expect variable-length datapoints (forwarder --compact)\n"
+              << "  -g, --group <addr>      Also join this IPv4 multicast group for UDP datagrams\n"
+              << "  -v, --verbose           Print every datapoint\n"
+              << "  --help                  Show this help message\n";
+}
+
+int main(int argc, char* argv[]) {
+    int port = 4620;
+    int duration = 0;
+    bool compact = false;
+    bool verbose = false;
+    std::string group;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        } else if ((arg == "-p" || arg == "--port") && i + 1 < argc) {
+            port = std::atoi(argv[++i]);
+        } else if ((arg == "-d" || arg == "--duration") && i + 1 < argc) {
+            duration = std::atoi(argv[++i]);
+        } else if ((arg == "-g" || arg == "--group") && i + 1 < argc) {
+            group = argv[++i];
+        } else if (arg == "--compact") {
+            compact = true;
+        } else if (arg == "-v" || arg == "--verbose") {
+            verbose = true;
+        } else {
+            std::cerr << "Error: Unknown argument " << arg << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::signal(SIGINT, signalHandler);
+    std::signal(SIGTERM, signalHandler);
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int flag = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 4) < 0) {
+        std::cerr << "Failed to listen on port " << port << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+    // Datagrams from forwarder --udp arrive on the same port number
+    int udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    setsockopt(udp_fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    if (bind(udp_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        std::cerr << "Failed to bind UDP port " << port << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+    if (!group.empty()) {
+        struct ip_mreq mreq;
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (inet_pton(AF_INET, group.c_str(), &mreq.imr_multiaddr) != 1 ||
+            setsockopt(udp_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+            std::cerr << "Failed to join multicast group " << group << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "Mock dataserver listening on port " << port << (compact ? " (compact framing)" : "") << std::endl;
+
+    std::vector<Connection> conns;
+    Stats stats;
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&]() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    while (keepRunning && (duration == 0 || elapsed() < duration)) {
+        std::vector<struct pollfd> pfds(2 + conns.size());
+        pfds[0].fd = listen_fd;
+        pfds[0].events = POLLIN;
+        pfds[1].fd = udp_fd;
+        pfds[1].events = POLLIN;
+        for (size_t i = 0; i < conns.size(); ++i) {
+            pfds[i + 2].fd = conns[i].fd;
+            pfds[i + 2].events = POLLIN;
+        }
+        if (poll(pfds.data(), pfds.size(), 100) <= 0) continue;
+
+        if (pfds[1].revents & POLLIN) {
+            char dgram[2048];
+            ssize_t n;
+            while ((n = recv(udp_fd, dgram, sizeof(dgram), MSG_DONTWAIT)) > 0) {
+                parseDatagram(dgram, n, verbose, stats);
+            }
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd >= 0) {
+                std::cout << "Client connected" << std::endl;
+                conns.push_back(Connection());
+                conns.back().fd = fd;
+            }
+        }
+
+        // Connections accepted above were not polled yet; they start next pass
+        for (size_t i = 0; i + 2 < pfds.size(); ++i) {
+            if (!(pfds[i + 2].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            Connection& conn = conns[i];
+            char chunk[16384];
+            ssize_t n = recv(conn.fd, chunk, sizeof(chunk), 0);
+            if (n > 0) {
+                conn.buf.insert(conn.buf.end(), chunk, chunk + n);
+                if (parseMessages(conn, compact, verbose, stats)) continue;
+            }
+            std::cout << "Client disconnected" << std::endl;
+            close(conn.fd);
+            conn.fd = -1;
+        }
+        conns.erase(std::remove_if(conns.begin(), conns.end(),
+                                   [](const Connection& c) { return c.fd < 0; }), conns.end());
+    }
+
+    printSummary(stats, elapsed());
+    for (auto& conn : conns) close(conn.fd);
+    close(udp_fd);
+    close(listen_fd);
+    return 0;
+}
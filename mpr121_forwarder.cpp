@@ -1,42 +1,105 @@
 #include <iostream>
 #include <cstring>
+#include <cstddef>
 #include <chrono>
 #include <thread>
 #include <atomic>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <string>
+#include <mutex>
+#include <functional>
+#include <algorithm>
+#include <limits>
+#include <fstream>
+#include <sstream>
 #include <csignal>
 #include <unistd.h>
 #include <iomanip>
+#include <random>
+#include <cmath>
 #include <ctime>
 #include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <poll.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <sched.h>
 #include <errno.h>
+#include <endian.h>
 
 // I2C includes for Linux
 #include <sys/ioctl.h>
+#include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 
+// GPIO character device, for the MPR121 IRQ line
+#include <linux/gpio.h>
+
 #define DPOINT_BINARY_MSG_CHAR '>'
 #define DPOINT_BINARY_FIXED_LENGTH 128
 #define DEFAULT_TIMER_INTERVAL_MS 20
-#define NSENSORS 6
+#define DEFAULT_CHANNEL_MASK 0x003F   // vals carry E0-E5 unless --channels says otherwise
 
 // MPR121 Constants
 #define MPR121_I2CADDR_DEFAULT 0x5A
+#define MPR121_I2CADDR_MAX 0x5D
 #define MPR121_TOUCHSTATUS_L 0x00
 #define MPR121_TOUCHSTATUS_H 0x01
+#define MPR121_OORSTATUS_L 0x02
 #define MPR121_FILTDATA_0L 0x04
+#define MPR121_BASELINE_0 0x1E
+#define MPR121_NCHANNELS 13
+#define MPR121_PROXIMITY 12         // channel number of the proximity channel
+#define MPR121_MHDR 0x2B            // baseline filter, rising then falling: MHD, NHD, NCL, FDL
+#define MPR121_NHDR 0x2C
+#define MPR121_NCLR 0x2D
+#define MPR121_FDLR 0x2E
+#define MPR121_MHDF 0x2F
+#define MPR121_NHDF 0x30
+#define MPR121_NCLF 0x31
+#define MPR121_FDLF 0x32
+#define MPR121_TOUCHTH_0 0x41       // touch/release threshold pairs for E0-E11
+#define MPR121_RELEASETH_0 0x42
+#define MPR121_CONFIG1 0x5C
 #define MPR121_CONFIG2 0x5D
 #define MPR121_ECR 0x5E
+#define MPR121_SOFTRESET 0x80
+#define MPR121_INIT_TIMEOUT_MS 100  // longest wait for the first conversion after start
+#define DEFAULT_TOUCH_THRESHOLD 12  // the thresholds begin() writes to the chip
+#define DEFAULT_RELEASE_THRESHOLD 6
+#define MPR121_CONFIG1_DEFAULT 0x10 // FFI 6 samples, CDC 16 uA
+#define MPR121_CONFIG2_DEFAULT 0x24 // CDT 0.5 us, SFI 4 samples, ESI 16 ms
+
+// Baseline filter MHDR through FDLF, from the AN3944 quick-start settings:
+// the baseline follows rising data at once and falling data (a touch) only
+// slowly
+const uint8_t MPR121_BASELINE_FILTER[MPR121_FDLF - MPR121_MHDR + 1] = {
+    0x01, 0x01, 0x00, 0x00,         // rising: MHD, NHD, NCL, FDL
+    0x01, 0x01, 0xFF, 0x02          // falling: MHD, NHD, NCL, FDL
+};
 
 // Dataserver configuration
 #define DSERV_PORT 4620
 const char* DEFAULT_DATASERVER_ADDRESS = "192.168.88.40";
-const int RECONNECT_DELAY_MS = 5000;
+const int RECONNECT_DELAY_MS = 5000;       // longest reconnect backoff
+const int RECONNECT_MIN_DELAY_MS = 250;    // first reconnect backoff
+const int CONNECT_TIMEOUT_MS = 5000;
+const int PEER_TIMEOUT_MS = 5000;          // default bound on detecting a dead peer
+const int HAPPY_EYEBALLS_DELAY_MS = 250;   // head start of each connection attempt over the next
+const int RESOLVE_REFRESH_MS = 60000;      // cached addresses older than this are re-resolved
+#define DSERV_OUTBUF_LIMIT (256 * 1024)
+#define SEND_IOV_MAX 64                    // segments gathered into one sendmsg()
 
 typedef enum {
     DSERV_BYTE = 0,
@@ -53,482 +116,4676 @@ typedef enum {
     DSERV_UNKNOWN,
 } ds_datatype_t;
 
-class MPR121 {
+// Register image returned by one auto-increment burst starting at
+// MPR121_TOUCHSTATUS_L: touch status (0x00-0x01), out-of-range status
+// (0x02-0x03), filtered data for E0-E11 and the proximity channel
+// (0x04-0x1D), then their baselines (0x1E-0x2A, counts >> 2). A burst only
+// covers the registers its device needs; the rest are zero.
+struct MPR121Sample {
+    uint16_t touched;
+    uint16_t oor;
+    uint16_t filtered[MPR121_NCHANNELS];
+    uint8_t baseline[MPR121_NCHANNELS];
+} __attribute__((packed));
+
+// Transport to one I2C device. MPR121 talks to the chip only through this
+// interface, so the same driver runs against /dev/i2c-N or a simulated chip.
+class I2CBackend {
+public:
+    virtual ~I2CBackend() {}
+
+    virtual bool open(const char* i2c_device, uint8_t addr) = 0;
+
+    // Plain write transaction (register address followed by data)
+    virtual bool write(const uint8_t* buf, size_t len) = 0;
+
+    // Write then read with a repeated start and a single stop
+    virtual bool writeRead(const uint8_t* wbuf, size_t wlen, uint8_t* rbuf, size_t rlen) = 0;
+};
+
+// i2c-dev character device backend
+class LinuxI2CBackend : public I2CBackend {
 private:
     int i2c_fd;
     uint8_t i2c_addr;
-    
+
 public:
-    MPR121(uint8_t addr = MPR121_I2CADDR_DEFAULT) : i2c_fd(-1), i2c_addr(addr) {}
-    
-    ~MPR121() {
+    LinuxI2CBackend() : i2c_fd(-1), i2c_addr(0) {}
+
+    ~LinuxI2CBackend() {
         if (i2c_fd >= 0) {
             close(i2c_fd);
         }
     }
-    
-    bool begin(const char* i2c_device = "/dev/i2c-1") {
-		// Open I2C device
-		i2c_fd = open(i2c_device, O_RDWR);
-		if (i2c_fd < 0) {
-			std::cerr << "Failed to open I2C device: " << i2c_device << std::endl;
-			return false;
-		}
-		
-		// Set I2C slave address
-		if (ioctl(i2c_fd, I2C_SLAVE, i2c_addr) < 0) {
-			std::cerr << "Failed to set I2C slave address: 0x" << std::hex << i2c_addr << std::endl;
-			close(i2c_fd);
-			i2c_fd = -1;
-			return false;
-		}
-	
-		// Stop electrode scanning before config
-		writeRegister(0x2B, 0x00);
-		std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
-		std::this_thread::sleep_for(std::chrono::milliseconds(100));
-	
-		// Set touch/release thresholds for first 6 electrodes (same as your working script)
-		for (int i = 0; i < 12; ++i) {
-			writeRegister(0x41 + i * 2, 12);  // Touch threshold
-			writeRegister(0x42 + i * 2, 6);   // Release threshold
-		}
-
-		writeRegister(file, 0x2C, 16); // Charge current
-		writeRegister(file, 0x2D, 1);  // Charge time
-
-		std::this_thread::sleep_for(std::chrono::milliseconds(100));
-		
-		// Enable first 6 electrodes 
-		writeRegister(0x2B, 0x0C);
-		
-		// Settle time
-		std::this_thread::sleep_for(std::chrono::milliseconds(100));
-		
-		return true;
-    }
-
-  int get_fd() { return i2c_fd; }
 
-  uint16_t touched() {
-        uint8_t t = readRegister8(MPR121_TOUCHSTATUS_L);
-        uint16_t v = readRegister8(MPR121_TOUCHSTATUS_H);
-        return ((v << 8) | t);
+    bool open(const char* i2c_device, uint8_t addr) {
+        i2c_addr = addr;
+
+        // Open I2C device
+        i2c_fd = ::open(i2c_device, O_RDWR);
+        if (i2c_fd < 0) {
+            std::cerr << "Failed to open I2C device: " << i2c_device << std::endl;
+            return false;
+        }
+
+        // Set I2C slave address
+        if (ioctl(i2c_fd, I2C_SLAVE, i2c_addr) < 0) {
+            std::cerr << "Failed to set I2C slave address: 0x" << std::hex << (int)i2c_addr << std::dec << std::endl;
+            close(i2c_fd);
+            i2c_fd = -1;
+            return false;
+        }
+        return true;
     }
-    
-    uint16_t filteredData(uint8_t t) {
-        if (t > 12) return 0;
-        return readRegister16(MPR121_FILTDATA_0L + t * 2);
+
+    bool write(const uint8_t* buf, size_t len) {
+        return ::write(i2c_fd, buf, len) == (ssize_t)len;
     }
-    
+
+    bool writeRead(const uint8_t* wbuf, size_t wlen, uint8_t* rbuf, size_t rlen) {
+        struct i2c_msg msgs[2];
+        msgs[0].addr = i2c_addr;
+        msgs[0].flags = 0;
+        msgs[0].len = wlen;
+        msgs[0].buf = const_cast<uint8_t*>(wbuf);
+        msgs[1].addr = i2c_addr;
+        msgs[1].flags = I2C_M_RD;
+        msgs[1].len = rlen;
+        msgs[1].buf = rbuf;
+
+        struct i2c_rdwr_ioctl_data xfer;
+        xfer.msgs = msgs;
+        xfer.nmsgs = 2;
+        return ioctl(i2c_fd, I2C_RDWR, &xfer) == 2;
+    }
+};
+
+// Knobs for the simulated backend
+struct SimOptions {
+    int bus_hz;             // modelled SCL rate; 0 makes transfers instantaneous
+    int latency_us;         // extra fixed latency per transaction
+    double nak_rate;        // probability a transaction is NAK'd
+    SimOptions() : bus_hz(100000), latency_us(0), nak_rate(0.0) {}
+};
+
+// Register-level model of an MPR121. Electrodes hover around a per-channel
+// baseline with a little noise and are touched at random: a touch pulls the
+// filtered value down, and touch status follows the configured touch and
+// release thresholds. The model advances with wall time whenever it is
+// read, so it behaves the same at any sample rate.
+class SimMPR121 {
 private:
-    void writeRegister(uint8_t reg, uint8_t value) {
-        uint8_t buffer[2] = {reg, value};
-        if (write(i2c_fd, buffer, 2) != 2) {
-            std::cerr << "Failed to write to register 0x" << std::hex << (int)reg << std::endl;
+    struct Electrode {
+        double baseline;
+        double depth;               // how far the current touch pulls the value down
+        double touch_end;           // seconds; touching while now < touch_end
+        double next_touch;
+    };
+
+    uint8_t regs[256];
+    uint8_t reg_ptr;
+    Electrode electrodes[MPR121_NCHANNELS];
+    std::mt19937 rng;
+    std::chrono::steady_clock::time_point start;
+
+    double elapsed() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void setWord(uint8_t reg, uint16_t v) {
+        regs[reg] = v & 0xFF;
+        regs[reg + 1] = v >> 8;
+    }
+
+    // The proximity channel is modelled as one more electrode
+    void update() {
+        int enabled = regs[MPR121_ECR] & 0x0F;
+        if (enabled > 12) enabled = 12;
+        if (enabled == 0) {
+            return;             // stop mode: data registers hold their values
+        }
+        bool proximity = (regs[MPR121_ECR] & 0x30) != 0;
+
+        double now = elapsed();
+        std::normal_distribution<double> noise(0.0, 1.5);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        uint16_t status = regs[MPR121_TOUCHSTATUS_L] | (regs[MPR121_TOUCHSTATUS_H] << 8);
+
+        for (int i = 0; i < MPR121_NCHANNELS; ++i) {
+            if (i >= enabled && !(i == MPR121_PROXIMITY && proximity)) {
+                continue;
+            }
+            Electrode& e = electrodes[i];
+            if (now >= e.next_touch) {
+                e.depth = 40 + 80 * uniform(rng);
+                e.touch_end = now + 0.1 + 1.4 * uniform(rng);
+                e.next_touch = e.touch_end - 5.0 * log(1.0 - uniform(rng));
+            }
+            double value = e.baseline + noise(rng) - (now < e.touch_end ? e.depth : 0);
+            uint16_t filtered = std::max(0.0, std::min(1023.0, value));
+            setWord(MPR121_FILTDATA_0L + i * 2, filtered);
+            regs[MPR121_BASELINE_0 + i] = (uint16_t)e.baseline >> 2;
+
+            // Touch and release thresholds apply to baseline - filtered
+            int delta = (int)e.baseline - filtered;
+            if (delta > regs[MPR121_TOUCHTH_0 + i * 2]) {
+                status |= (1 << i);
+            } else if (delta < regs[MPR121_RELEASETH_0 + i * 2]) {
+                status &= ~(1 << i);
+            }
         }
+        setWord(MPR121_TOUCHSTATUS_L, status);
     }
-    
-    uint8_t readRegister8(uint8_t reg) {
-        if (write(i2c_fd, &reg, 1) != 1) {
-            std::cerr << "Failed to write register address" << std::endl;
-            return 0;
+
+public:
+    SimMPR121(uint32_t seed) : rng(seed) {
+        reset();
+    }
+
+    // Power-on register state
+    void reset() {
+        memset(regs, 0, sizeof(regs));
+        regs[MPR121_CONFIG1] = MPR121_CONFIG1_DEFAULT;
+        regs[MPR121_CONFIG2] = MPR121_CONFIG2_DEFAULT;
+        reg_ptr = 0;
+        start = std::chrono::steady_clock::now();
+
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        for (int i = 0; i < MPR121_NCHANNELS; ++i) {
+            electrodes[i].baseline = 550 + 150 * uniform(rng);
+            electrodes[i].depth = 0;
+            electrodes[i].touch_end = 0;
+            electrodes[i].next_touch = 1.0 + 5.0 * uniform(rng);
         }
-        
-        uint8_t value;
-        if (read(i2c_fd, &value, 1) != 1) {
-            std::cerr << "Failed to read register" << std::endl;
-            return 0;
+    }
+
+    void write(const uint8_t* buf, size_t len) {
+        if (len == 0) return;
+        reg_ptr = buf[0];
+        for (size_t i = 1; i < len; ++i, ++reg_ptr) {
+            if (reg_ptr == MPR121_SOFTRESET) {
+                if (buf[i] == 0x63) reset();
+                continue;
+            }
+            // Like the chip, only ECR may change while electrodes are running
+            bool running = (regs[MPR121_ECR] & 0x3F) != 0;
+            if (reg_ptr >= 0x2B && (!running || reg_ptr == MPR121_ECR)) {
+                regs[reg_ptr] = buf[i];
+            }
         }
-        
-        return value;
     }
-    
-    uint16_t readRegister16(uint8_t reg) {
-        if (write(i2c_fd, &reg, 1) != 1) {
-            std::cerr << "Failed to write register address" << std::endl;
-            return 0;
+
+    void read(uint8_t* buf, size_t len) {
+        update();
+        for (size_t i = 0; i < len; ++i) {
+            buf[i] = regs[reg_ptr++];
         }
-        
-        uint8_t buffer[2];
-        if (read(i2c_fd, buffer, 2) != 2) {
-            std::cerr << "Failed to read register" << std::endl;
-            return 0;
+    }
+
+    // When the touch status will next change, as of the last read: the
+    // earliest touch start or release among the running electrodes. Returns
+    // false in stop mode, where the status never changes.
+    bool nextTransition(std::chrono::steady_clock::time_point& when) const {
+        int enabled = std::min(regs[MPR121_ECR] & 0x0F, 12);
+        if (enabled == 0) {
+            return false;
         }
-        
-        return (buffer[1] << 8) | buffer[0];
+        double now = elapsed();
+        double next = std::numeric_limits<double>::max();
+        for (int i = 0; i < enabled; ++i) {
+            const Electrode& e = electrodes[i];
+            next = std::min(next, now < e.touch_end ? e.touch_end : e.next_touch);
+        }
+        when = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(next));
+        return true;
+    }
+};
+
+// Backend that serves a SimMPR121 with modelled bus timing and optional
+// injected NAKs
+class SimI2CBackend : public I2CBackend {
+private:
+    SimOptions options;
+    SimMPR121 chip;
+    std::mt19937 rng;
+
+    // Hold the caller for as long as the transfer would occupy the bus
+    bool transfer(size_t bytes) {
+        long ns = options.latency_us * 1000L;
+        if (options.bus_hz > 0) {
+            ns += (long)((bytes + 1) * 9 * 1e9 / options.bus_hz);   // +1 for the address byte
+        }
+        if (ns > 0) {
+            struct timespec ts = { ns / 1000000000L, ns % 1000000000L };
+            while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR) {}
+        }
+        if (options.nak_rate > 0 && std::uniform_real_distribution<double>(0.0, 1.0)(rng) < options.nak_rate) {
+            errno = EREMOTEIO;
+            return false;
+        }
+        return true;
     }
+
 public:
-  bool readRegisters(uint8_t startReg, uint8_t *buffer, size_t length) {
-    if (write(i2c_fd, &startReg, 1) != 1) return false;
-    return read(i2c_fd, buffer, length) == (ssize_t)length;
-  }
-  
+    SimI2CBackend(const SimOptions& opts, uint32_t seed) : options(opts), chip(seed), rng(seed + 1) {}
+
+    bool open(const char*, uint8_t) {
+        return true;
+    }
+
+    bool write(const uint8_t* buf, size_t len) {
+        if (!transfer(len)) return false;
+        chip.write(buf, len);
+        return true;
+    }
+
+    bool writeRead(const uint8_t* wbuf, size_t wlen, uint8_t* rbuf, size_t rlen) {
+        if (!transfer(wlen + rlen + 1)) return false;
+        chip.write(wbuf, wlen);
+        chip.read(rbuf, rlen);
+        return true;
+    }
+
+    SimMPR121& model() { return chip; }
 };
 
-class DataserverClient {
+class MPR121 {
 private:
-    int sockfd;
-    std::string server_address;
-    int server_port;
-    std::atomic<bool> connected;
-    std::atomic<bool> should_reconnect;
+    std::unique_ptr<I2CBackend> bus;
+    uint8_t i2c_addr;
+    uint8_t n_electrodes;
+    uint16_t read_mask;             // channels sample() reads
+    bool read_baseline;
+    bool resumed;
+    bool opened;
+
+    // ECR value begin() starts the chip with: every electrode, plus
+    // proximity detection over all of them when its channel is read
+    uint8_t runConfig() const {
+        return n_electrodes | ((read_mask & (1 << MPR121_PROXIMITY)) ? 0x30 : 0);
+    }
     
 public:
-    DataserverClient(const std::string& addr, int port) 
-        : sockfd(-1), server_address(addr), server_port(port), 
-          connected(false), should_reconnect(true) {}
+    MPR121(uint8_t addr = MPR121_I2CADDR_DEFAULT)
+        : bus(new LinuxI2CBackend()), i2c_addr(addr), n_electrodes(12), read_mask(0x0FFF),
+          read_baseline(false), resumed(false), opened(false) {}
     
-    ~DataserverClient() {
-        disconnect();
+    // Replace the transport (call before begin())
+    void setBackend(I2CBackend* backend) {
+        bus.reset(backend);
+    }
+
+    // Channels sample() has to return (bit 12 is the proximity channel),
+    // and whether their baselines are needed too. The burst stops at the
+    // last register that covers them. Call before begin().
+    void setChannels(uint16_t mask, bool baseline) {
+        read_mask = mask;
+        read_baseline = baseline;
     }
     
-    bool connect() {
-        if (connected.load()) {
+    // Bring the chip up in a handful of transactions: stop it, program the
+    // thresholds and baseline filter with one auto-increment write each,
+    // start it, then poll for the first conversion instead of sleeping. A
+    // chip an earlier run left running with the same configuration keeps
+    // its baselines and is not touched at all (configured() says which).
+    bool begin(const char* i2c_device = "/dev/i2c-1") {
+        opened = bus->open(i2c_device, i2c_addr);
+        if (!opened) {
+            return false;
+        }
+
+        resumed = isConfigured();
+        if (resumed) {
             return true;
         }
-        
-        // Create socket
-        sockfd = socket(AF_INET, SOCK_STREAM, 0);
-        if (sockfd < 0) {
-            std::cerr << "Failed to create socket: " << strerror(errno) << std::endl;
+        return configure();
+    }
+
+    // Soft reset a chip that stopped answering and configure it again
+    bool recover() {
+        uint8_t reset[] = { MPR121_SOFTRESET, 0x63 };
+        if (!bus->write(reset, sizeof(reset))) {
             return false;
         }
-        
-        // Set socket options
-        int flag = 1;
-        setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
-        
-        // Set non-blocking for connection timeout
-        int flags = fcntl(sockfd, F_GETFL, 0);
-        fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
-        
-        // Resolve hostname
-        struct hostent* host_entry = gethostbyname(server_address.c_str());
-        if (!host_entry) {
-            std::cerr << "Failed to resolve hostname: " << server_address << std::endl;
-            close(sockfd);
-            sockfd = -1;
+        resumed = false;
+        return configure();
+    }
+
+    // True if begin() found the chip already running with its configuration
+    bool configured() const {
+        return resumed;
+    }
+
+    // True once begin() has the bus device open, even if the chip did not answer
+    bool isOpen() const {
+        return opened;
+    }
+
+    // Read touch status, out-of-range status and filtered data for all
+    // enabled electrodes in a single combined transaction (register address
+    // write, repeated start, burst read), instead of one write+read pair per
+    // register block.
+    bool sample(MPR121Sample& s) {
+        uint8_t reg = MPR121_TOUCHSTATUS_L;
+        uint16_t len = sampleLength();
+        if (!bus->writeRead(&reg, 1, reinterpret_cast<uint8_t*>(&s), len)) {
             return false;
         }
-        
-        // Setup server address
-        struct sockaddr_in server_addr;
-        memset(&server_addr, 0, sizeof(server_addr));
-        server_addr.sin_family = AF_INET;
-        server_addr.sin_port = htons(server_port);
-        memcpy(&server_addr.sin_addr, host_entry->h_addr, host_entry->h_length);
-        
-        // Attempt connection
-        int result = ::connect(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr));
-        
-        if (result < 0) {
-            if (errno == EINPROGRESS) {
-                // Wait for connection to complete
-                fd_set write_fds;
-                struct timeval timeout = {5, 0}; // 5 second timeout
-                
-                FD_ZERO(&write_fds);
-                FD_SET(sockfd, &write_fds);
-                
-                result = select(sockfd + 1, NULL, &write_fds, NULL, &timeout);
-                
-                if (result > 0) {
-                    int so_error;
-                    socklen_t len = sizeof(so_error);
-                    getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &so_error, &len);
-                    
-                    if (so_error != 0) {
-                        std::cerr << "Connection failed: " << strerror(so_error) << std::endl;
-                        close(sockfd);
-                        sockfd = -1;
-                        return false;
-                    }
-                } else {
-                    std::cerr << "Connection timeout" << std::endl;
-                    close(sockfd);
-                    sockfd = -1;
-                    return false;
-                }
-            } else {
-                std::cerr << "Connection failed: " << strerror(errno) << std::endl;
-                close(sockfd);
-                sockfd = -1;
-                return false;
-            }
+        memset(reinterpret_cast<uint8_t*>(&s) + len, 0, sizeof(s) - len);
+
+        s.touched = le16toh(s.touched);
+        s.oor = le16toh(s.oor);
+        for (int i = 0; i < MPR121_NCHANNELS; ++i) {
+            s.filtered[i] = le16toh(s.filtered[i]);
         }
-        
-        // Set back to blocking mode
-        fcntl(sockfd, F_SETFL, flags & ~O_NONBLOCK);
-        
-        connected.store(true);
-        std::cout << "Connected to dataserver at " << server_address << ":" << server_port << std::endl;
         return true;
     }
-    
-    void disconnect() {
-        if (sockfd >= 0) {
-            close(sockfd);
-            sockfd = -1;
+
+    // Read just the two touch status bytes. On the chip this also releases
+    // the IRQ line.
+    bool touchStatus(uint16_t& status) {
+        uint8_t reg = MPR121_TOUCHSTATUS_L;
+        uint8_t buffer[2];
+        if (!bus->writeRead(&reg, 1, buffer, 2)) {
+            return false;
         }
-        connected.store(false);
+        status = (buffer[1] << 8) | buffer[0];
+        return true;
+    }
+
+    // Number of bytes sample() reads for the channels it has to return
+    uint16_t sampleLength() const {
+        int channels = 0;
+        while (channels < MPR121_NCHANNELS && (read_mask >> channels)) ++channels;
+        if (read_baseline) {
+            return offsetof(MPR121Sample, baseline) + channels;
+        }
+        return offsetof(MPR121Sample, filtered) + channels * sizeof(uint16_t);
+    }
+
+  uint16_t touched() {
+        uint8_t t = readRegister8(MPR121_TOUCHSTATUS_L);
+        uint16_t v = readRegister8(MPR121_TOUCHSTATUS_H);
+        return ((v << 8) | t);
     }
     
-    bool isConnected() const {
-        return connected.load();
+    uint16_t filteredData(uint8_t t) {
+        if (t > 12) return 0;
+        return readRegister16(MPR121_FILTDATA_0L + t * 2);
     }
     
-    bool testConnection() {
-        if (!connected.load() || sockfd < 0) {
+private:
+    bool writeRegister(uint8_t reg, uint8_t value) {
+        uint8_t buffer[2] = {reg, value};
+        if (!bus->write(buffer, 2)) {
+            std::cerr << "Failed to write to register 0x" << std::hex << (int)reg << std::dec << std::endl;
             return false;
         }
-        
-        // Use recv with MSG_PEEK and MSG_DONTWAIT to test if socket is still alive
-        char test_buf[1];
-        int result = recv(sockfd, test_buf, 1, MSG_PEEK | MSG_DONTWAIT);
-        
-        if (result == 0) {
-            // Connection closed by remote host
-            std::cerr << "Connection closed by remote host" << std::endl;
-            connected.store(false);
-            disconnect();
+        return true;
+    }
+
+    bool configure() {
+        // Configuration registers only accept writes in stop mode
+        if (!writeRegister(MPR121_ECR, 0x00)) {
             return false;
-        } else if (result < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                // No data available, but connection is still alive
-                return true;
-            } else {
-                // Real error occurred
-                std::cerr << "Connection test failed: " << strerror(errno) << std::endl;
-                connected.store(false);
-                disconnect();
+        }
+
+        uint8_t thresholds[1 + 2 * 12];
+        thresholds[0] = MPR121_TOUCHTH_0;
+        for (int i = 0; i < 12; ++i) {
+            thresholds[1 + i * 2] = DEFAULT_TOUCH_THRESHOLD;
+            thresholds[2 + i * 2] = DEFAULT_RELEASE_THRESHOLD;
+        }
+        uint8_t filter[1 + sizeof(MPR121_BASELINE_FILTER)];
+        filter[0] = MPR121_MHDR;
+        memcpy(&filter[1], MPR121_BASELINE_FILTER, sizeof(MPR121_BASELINE_FILTER));
+        uint8_t afe[] = { MPR121_CONFIG1, MPR121_CONFIG1_DEFAULT, MPR121_CONFIG2_DEFAULT };
+        if (!bus->write(thresholds, sizeof(thresholds)) || !bus->write(filter, sizeof(filter)) ||
+            !bus->write(afe, sizeof(afe))) {
+            std::cerr << "Failed to write configuration" << std::endl;
+            return false;
+        }
+
+        // Data registers hold their last values in stop mode; the first
+        // conversion changes at least one of them
+        uint8_t before[24], after[24];
+        if (!readRegisters(MPR121_FILTDATA_0L, before, sizeof(before)) ||
+            !writeRegister(MPR121_ECR, runConfig())) {
+            return false;
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(MPR121_INIT_TIMEOUT_MS);
+        while (std::chrono::steady_clock::now() < deadline) {
+            if (!readRegisters(MPR121_FILTDATA_0L, after, n_electrodes * 2)) {
                 return false;
             }
+            if (memcmp(before, after, n_electrodes * 2) != 0) {
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
         }
-        
-        return true; // Connection is good
+        // A chip that never converts is not usable; leave it to the
+        // retry and quarantine path
+        std::cerr << "MPR121 at 0x" << std::hex << (int)i2c_addr << std::dec << " did not start converting within "
+                  << MPR121_INIT_TIMEOUT_MS << " ms" << std::endl;
+        return false;
     }
-    
-    bool writeToDataserver(const char* varname, int dtype, int len, void* data) {
-        if (!connected.load()) {
+
+    // One burst read of the baseline filter through ECR, compared with what
+    // configure() writes
+    bool isConfigured() {
+        uint8_t regs[MPR121_ECR - MPR121_MHDR + 1];
+        if (!readRegisters(MPR121_MHDR, regs, sizeof(regs))) {
             return false;
         }
-        
-        static char buf[DPOINT_BINARY_FIXED_LENGTH];
-        uint8_t cmd = DPOINT_BINARY_MSG_CHAR;
-        uint16_t varlen = strlen(varname);
-        uint64_t timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
-            std::chrono::high_resolution_clock::now().time_since_epoch()).count();
-        uint32_t datatype = dtype;
-        uint32_t datalen = len;
-        
-        uint16_t bufidx = 0;
-        uint16_t total_bytes = sizeof(uint8_t) + sizeof(uint16_t) + varlen + 
-                              sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint32_t) + len;
-        
-        if (total_bytes > sizeof(buf)) {
-            std::cerr << "Data too large for buffer" << std::endl;
+        auto reg = [&](uint8_t r) { return regs[r - MPR121_MHDR]; };
+        if (reg(MPR121_ECR) != runConfig() || reg(MPR121_CONFIG1) != MPR121_CONFIG1_DEFAULT ||
+            reg(MPR121_CONFIG2) != MPR121_CONFIG2_DEFAULT ||
+            memcmp(regs, MPR121_BASELINE_FILTER, sizeof(MPR121_BASELINE_FILTER)) != 0) {
             return false;
         }
-        
-        // Pack the data
-        memcpy(&buf[bufidx], &cmd, sizeof(uint8_t));
-        bufidx += sizeof(uint8_t);
-        
-        memcpy(&buf[bufidx], &varlen, sizeof(uint16_t));
-        bufidx += sizeof(uint16_t);
-        
-        memcpy(&buf[bufidx], varname, varlen);
-        bufidx += varlen;
-        
-        memcpy(&buf[bufidx], &timestamp, sizeof(uint64_t));
-        bufidx += sizeof(uint64_t);
-        
-        memcpy(&buf[bufidx], &datatype, sizeof(uint32_t));
-        bufidx += sizeof(uint32_t);
-        
-        memcpy(&buf[bufidx], &datalen, sizeof(uint32_t));
-        bufidx += sizeof(uint32_t);
-        
-        memcpy(&buf[bufidx], data, datalen);
-        bufidx += datalen;
-        
-        // Send the data
-        ssize_t bytes_sent = send(sockfd, buf, sizeof(buf), MSG_NOSIGNAL);
-        if (bytes_sent < 0) {
-            if (errno == EPIPE || errno == ECONNRESET || errno == ENOTCONN) {
-                std::cerr << "Connection lost, will attempt reconnection" << std::endl;
-                connected.store(false);
-                disconnect();
-            } else {
-                std::cerr << "Send failed: " << strerror(errno) << std::endl;
+        for (int i = 0; i < 12; ++i) {
+            if (reg(MPR121_TOUCHTH_0 + i * 2) != DEFAULT_TOUCH_THRESHOLD ||
+                reg(MPR121_RELEASETH_0 + i * 2) != DEFAULT_RELEASE_THRESHOLD) {
+                return false;
             }
-            return false;
         }
-        
         return true;
     }
     
-    void startReconnectLoop() {
-        should_reconnect.store(true);
-        std::thread([this]() {
-            while (should_reconnect.load()) {
-                if (!connected.load()) {
-                    std::cout << "Attempting to reconnect to dataserver..." << std::endl;
-                    if (connect()) {
-                        std::cout << "Reconnected successfully!" << std::endl;
-                    } else {
-                        std::cout << "Reconnection failed, retrying in " << RECONNECT_DELAY_MS/1000 << " seconds..." << std::endl;
-                    }
-                }
-                std::this_thread::sleep_for(std::chrono::milliseconds(RECONNECT_DELAY_MS));
-            }
-        }).detach();
+    uint8_t readRegister8(uint8_t reg) {
+        uint8_t value;
+        if (!bus->writeRead(&reg, 1, &value, 1)) {
+            std::cerr << "Failed to read register" << std::endl;
+            return 0;
+        }
+        
+        return value;
     }
     
-    void stopReconnectLoop() {
-        should_reconnect.store(false);
+    uint16_t readRegister16(uint8_t reg) {
+        uint8_t buffer[2];
+        if (!bus->writeRead(&reg, 1, buffer, 2)) {
+            std::cerr << "Failed to read register" << std::endl;
+            return 0;
+        }
+        
+        return (buffer[1] << 8) | buffer[0];
     }
+public:
+  bool readRegisters(uint8_t startReg, uint8_t *buffer, size_t length) {
+    return bus->writeRead(&startReg, 1, buffer, length);
+  }
+  
 };
 
-// Global variables
-std::atomic<bool> running(true);
-MPR121 cap0(0x5A);
-MPR121 cap1(0x5B);
+// The MPR121 IRQ output: active low, asserted when the touch status changes
+// and released when the status registers are read. A line source is an fd
+// that becomes readable on each falling edge.
+class IrqLine {
+public:
+    virtual ~IrqLine() {}
 
-// Add this debug function in the main loop, right after the filtered data reads:
-void printDebugOutput(MPR121& sensor, int sensor_num, uint16_t filtered_data[6])
-{
-  auto now = std::chrono::system_clock::now();
-  auto t = std::chrono::system_clock::to_time_t(now);
-  
-  std::cout << "Sensor[" << sensor_num << "] " 
+    virtual int fd() const = 0;
+
+    // Consume pending edges before the status read that releases the line,
+    // so an edge that arrives during the read is not lost
+    virtual void acknowledge() = 0;
+
+    // Called after that status read
+    virtual void rearm() {}
+};
+
+// Falling-edge events from a line on /dev/gpiochipN (GPIO uAPI v2). Works
+// the same against the gpio-sim module, whose lines can be pulled from
+// configfs/sysfs to inject edges.
+class GpioIrqLine : public IrqLine {
+private:
+    int line_fd;
+
+public:
+    GpioIrqLine() : line_fd(-1) {}
+
+    ~GpioIrqLine() {
+        if (line_fd >= 0) {
+            close(line_fd);
+        }
+    }
+
+    bool open(const std::string& chip, unsigned int offset) {
+        int chip_fd = ::open(chip.c_str(), O_RDONLY | O_CLOEXEC);
+        if (chip_fd < 0) {
+            std::cerr << "Failed to open GPIO chip " << chip << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+
+        // The IRQ output is open drain, so ask for the pull-up as well
+        struct gpio_v2_line_request request;
+        memset(&request, 0, sizeof(request));
+        request.offsets[0] = offset;
+        request.num_lines = 1;
+        request.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_FALLING |
+                               GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+        strncpy(request.consumer, "mpr121_forwarder", sizeof(request.consumer) - 1);
+
+        int rc = ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &request);
+        int err = errno;
+        close(chip_fd);
+        if (rc < 0) {
+            std::cerr << "Failed to request line " << offset << " on " << chip << ": " << strerror(err) << std::endl;
+            return false;
+        }
+        line_fd = request.fd;
+        fcntl(line_fd, F_SETFL, fcntl(line_fd, F_GETFL) | O_NONBLOCK);
+        return true;
+    }
+
+    int fd() const { return line_fd; }
+
+    void acknowledge() {
+        struct gpio_v2_line_event events[16];
+        while (read(line_fd, events, sizeof(events)) == (ssize_t)sizeof(events)) {}
+    }
+};
+
+// Stand-in for the IRQ line of a SimMPR121: a timer armed for the model's
+// next touch status change
+class SimIrqLine : public IrqLine {
+private:
+    SimMPR121& chip;
+    int timer_fd;
+
+public:
+    SimIrqLine(SimMPR121& model) : chip(model) {
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        rearm();
+    }
+
+    ~SimIrqLine() {
+        if (timer_fd >= 0) {
+            close(timer_fd);
+        }
+    }
+
+    int fd() const { return timer_fd; }
+
+    void acknowledge() {
+        uint64_t expirations;
+        if (read(timer_fd, &expirations, sizeof(expirations)) < 0) {}
+    }
+
+    // steady_clock is CLOCK_MONOTONIC, so the model's time points can be
+    // used as absolute timer deadlines. A zero deadline disarms the timer.
+    void rearm() {
+        struct itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        std::chrono::steady_clock::time_point when;
+        if (chip.nextTransition(when)) {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(when.time_since_epoch()).count();
+            ns = std::max<int64_t>(ns, 1);
+            spec.it_value.tv_sec = ns / 1000000000LL;
+            spec.it_value.tv_nsec = ns % 1000000000LL;
+        }
+        timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+    }
+};
+
+#define HIST_SUB_BITS 4
+#define HIST_LINEAR (2 << HIST_SUB_BITS)
+#define HIST_BUCKETS (HIST_LINEAR + (64 - HIST_SUB_BITS - 1) * (1 << HIST_SUB_BITS))
+
+// Log-linear latency histogram in the style of HdrHistogram: exact below
+// HIST_LINEAR ns, then 16 buckets per power of two (about 6% resolution)
+// up to 2^64 ns. Recording is a single relaxed atomic add, so the hot path
+// never takes a lock and readers can snapshot at any time.
+class Histogram {
+private:
+    std::atomic<uint64_t> counts[HIST_BUCKETS];
+    std::atomic<uint64_t> max_value;
+
+    static int bucketIndex(uint64_t v) {
+        if (v < HIST_LINEAR) {
+            return v;
+        }
+        int e = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+        return HIST_LINEAR + (e - 1) * (1 << HIST_SUB_BITS) + (int)((v >> e) - (1 << HIST_SUB_BITS));
+    }
+
+    // Largest value that falls into a bucket
+    static uint64_t bucketLimit(int idx) {
+        if (idx < HIST_LINEAR) {
+            return idx;
+        }
+        int e = (idx - HIST_LINEAR) / (1 << HIST_SUB_BITS) + 1;
+        uint64_t m = (idx - HIST_LINEAR) % (1 << HIST_SUB_BITS) + (1 << HIST_SUB_BITS);
+        return ((m + 1) << e) - 1;
+    }
+
+public:
+    Histogram() : max_value(0) {
+        reset();
+    }
+
+    void record(uint64_t v) {
+        counts[bucketIndex(v)].fetch_add(1, std::memory_order_relaxed);
+        uint64_t m = max_value.load(std::memory_order_relaxed);
+        while (v > m && !max_value.compare_exchange_weak(m, v, std::memory_order_relaxed)) {}
+    }
+
+    void reset() {
+        for (int i = 0; i < HIST_BUCKETS; ++i) {
+            counts[i].store(0, std::memory_order_relaxed);
+        }
+        max_value.store(0, std::memory_order_relaxed);
+    }
+
+    // Summary of the distribution, values in ns
+    struct Summary {
+        uint64_t count;
+        uint64_t p50, p90, p99, p999, max;
+    };
+
+    Summary summarize() const {
+        uint64_t snapshot[HIST_BUCKETS];
+        Summary s;
+        s.count = 0;
+        for (int i = 0; i < HIST_BUCKETS; ++i) {
+            snapshot[i] = counts[i].load(std::memory_order_relaxed);
+            s.count += snapshot[i];
+        }
+        s.max = max_value.load(std::memory_order_relaxed);
+
+        const double quantiles[4] = { 0.5, 0.9, 0.99, 0.999 };
+        uint64_t* results[4] = { &s.p50, &s.p90, &s.p99, &s.p999 };
+        uint64_t seen = 0;
+        int q = 0;
+        for (int i = 0; i < HIST_BUCKETS && q < 4; ++i) {
+            seen += snapshot[i];
+            while (q < 4 && s.count && seen >= (uint64_t)(quantiles[q] * s.count + 0.5)) {
+                *results[q++] = std::min(bucketLimit(i), s.max);
+            }
+        }
+        for (; q < 4; ++q) {
+            *results[q] = s.max;
+        }
+        return s;
+    }
+
+    // Summary packed for a DSERV_INT[6] datapoint: count, then p50, p90,
+    // p99, p99.9 and max in microseconds
+    void pack(int32_t out[6]) const {
+        Summary s = summarize();
+        out[0] = (int32_t)std::min<uint64_t>(s.count, INT32_MAX);
+        out[1] = (int32_t)std::min<uint64_t>(s.p50 / 1000, INT32_MAX);
+        out[2] = (int32_t)std::min<uint64_t>(s.p90 / 1000, INT32_MAX);
+        out[3] = (int32_t)std::min<uint64_t>(s.p99 / 1000, INT32_MAX);
+        out[4] = (int32_t)std::min<uint64_t>(s.p999 / 1000, INT32_MAX);
+        out[5] = (int32_t)std::min<uint64_t>(s.max / 1000, INT32_MAX);
+    }
+
+    void print(std::ostream& out, const std::string& name) const {
+        Summary s = summarize();
+        out << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(1)
+            << " n=" << s.count
+            << " p50=" << s.p50 / 1000.0 << "us"
+            << " p90=" << s.p90 / 1000.0 << "us"
+            << " p99=" << s.p99 / 1000.0 << "us"
+            << " p99.9=" << s.p999 / 1000.0 << "us"
+            << " max=" << s.max / 1000.0 << "us" << std::endl;
+        out.unsetf(std::ios::fixed);
+    }
+};
+
+#define SPOOL_MAGIC 0x314c4f4f50534752ULL    // "RGSPOOL1"
+#define SPOOL_RECORD_SIZE DPOINT_BINARY_FIXED_LENGTH
+#define DEFAULT_SPOOL_CAPACITY 65536            // datapoints, 8 MiB of records
+#define DEFAULT_SPOOL_RATE 2000                 // replayed datapoints per second
+#define SPOOL_REPLAY_PERIOD_MS 10
+
+// Bounded FIFO of packed datapoints kept while the dataserver is unreachable.
+// Each record is the datapoint exactly as packed, so it keeps its original
+// acquisition timestamp. The ring lives in anonymous memory, or in a file
+// mapped MAP_SHARED so that its contents survive a crash or restart of the
+// forwarder and are replayed on the next connection. When full, the oldest
+// record is overwritten. Not thread-safe; the client serialises access.
+class Spool {
+private:
+    struct Header {
+        uint64_t magic;
+        uint64_t capacity;
+        uint64_t head;              // records ever written
+        uint64_t tail;              // records ever read
+    };
+
+    Header* header;
+    char* records;
+    size_t map_len;
+
+public:
+    Spool() : header(NULL), records(NULL), map_len(0) {}
+
+    ~Spool() {
+        if (header) {
+            munmap(header, map_len);
+        }
+    }
+
+    // An empty path keeps the spool in memory only
+    bool open(size_t capacity, const std::string& path) {
+        map_len = sizeof(Header) + capacity * SPOOL_RECORD_SIZE;
+        void* mem;
+        if (path.empty()) {
+            mem = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        } else {
+            int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                std::cerr << "Failed to open spool file " << path << ": " << strerror(errno) << std::endl;
+                return false;
+            }
+            if (ftruncate(fd, map_len) < 0) {
+                std::cerr << "Failed to size spool file " << path << ": " << strerror(errno) << std::endl;
+                ::close(fd);
+                return false;
+            }
+            mem = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+        }
+        if (mem == MAP_FAILED) {
+            std::cerr << "Failed to map spool: " << strerror(errno) << std::endl;
+            return false;
+        }
+        header = static_cast<Header*>(mem);
+        records = static_cast<char*>(mem) + sizeof(Header);
+
+        // A file left by an earlier run is reused if it has the same layout
+        bool valid = header->magic == SPOOL_MAGIC && header->capacity == capacity &&
+                     header->head >= header->tail && header->head - header->tail <= capacity;
+        if (!valid) {
+            header->magic = SPOOL_MAGIC;
+            header->capacity = capacity;
+            header->head = 0;
+            header->tail = 0;
+        } else if (size() > 0) {
+            std::cout << "Spool " << path << " holds " << size() << " datapoints from an earlier run" << std::endl;
+        }
+        return true;
+    }
+
+    bool isOpen() const {
+        return header != NULL;
+    }
+
+    size_t size() const {
+        return header ? header->head - header->tail : 0;
+    }
+
+    // Returns false if the oldest record had to be dropped to make room
+    bool push(const char* msg, size_t len) {
+        bool dropped = false;
+        if (size() == header->capacity) {
+            header->tail++;
+            dropped = true;
+        }
+        char* rec = records + (header->head % header->capacity) * SPOOL_RECORD_SIZE;
+        memcpy(rec, msg, len);
+        if (len < SPOOL_RECORD_SIZE) {
+            memset(rec + len, 0, SPOOL_RECORD_SIZE - len);
+        }
+        // Publish the record only once it is complete
+        header->head++;
+        return !dropped;
+    }
+
+    // Oldest record, valid until the next pop()
+    const char* front() const {
+        return records + (header->tail % header->capacity) * SPOOL_RECORD_SIZE;
+    }
+
+    void pop() {
+        header->tail++;
+    }
+
+    // Packed length of the datapoint in a record, or 0 if it does not hold a
+    // whole one. A spool file can hold a torn record after a crash, so its
+    // header is checked against the record size before it is trusted.
+    static size_t datapointLength(const char* rec) {
+        uint16_t varlen;
+        uint32_t datalen;
+        if (rec[0] != DPOINT_BINARY_MSG_CHAR) {
+            return 0;
+        }
+        memcpy(&varlen, rec + 1, sizeof(varlen));
+        if (19 + (size_t)varlen > SPOOL_RECORD_SIZE) {
+            return 0;
+        }
+        memcpy(&datalen, rec + 15 + varlen, sizeof(datalen));
+        if (19 + (size_t)varlen + datalen > SPOOL_RECORD_SIZE) {
+            return 0;
+        }
+        return 19 + varlen + datalen;
+    }
+};
+
+// What a full ring or send queue does with a new item
+enum OverflowPolicy {
+    DROP_OLDEST,    // discard the oldest queued item to make room
+    DROP_NEWEST     // discard the item being pushed
+};
+
+#define PACK_BLOCK_SIZE (64 * 1024)
+
+// Datapoints packed by the sender thread. A block is filled front to back and
+// handed out as segments; bytes covered by a segment are never written
+// again, so every destination's send queue shares them without copying.
+struct PackBlock {
+    std::unique_ptr<char[]> data;
+    size_t capacity;
+
+    explicit PackBlock(size_t size) : data(new char[size]), capacity(size) {}
+};
+
+// A run of whole messages in a PackBlock; holding one keeps the block alive
+struct Segment {
+    std::shared_ptr<PackBlock> block;
+    size_t begin;
+    size_t end;
+
+    const char* data() const { return block->data.get() + begin; }
+    size_t size() const { return end - begin; }
+};
+
+// One background getaddrinfo() lookup. The resolver thread and the client
+// share it, so a lookup still stuck in DNS when the client shuts down only
+// ever touches this object and its own copy of the notification eventfd.
+struct ResolveJob {
+    std::mutex mutex;
+    bool done;
+    int error;                      // getaddrinfo() status
+    std::vector<struct sockaddr_storage> addrs;
+    int notify_fd;
+
+    explicit ResolveJob(int fd) : done(false), error(0), notify_fd(fd) {}
+    ~ResolveJob() {
+        if (notify_fd >= 0) close(notify_fd);
+    }
+};
+
+socklen_t addressLength(const struct sockaddr_storage& addr) {
+    return addr.ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+bool sameAddress(const struct sockaddr_storage& a, const struct sockaddr_storage& b) {
+    return a.ss_family == b.ss_family && memcmp(&a, &b, addressLength(a)) == 0;
+}
+
+std::string formatAddress(const struct sockaddr_storage& addr) {
+    char host[NI_MAXHOST];
+    if (getnameinfo((const struct sockaddr*)&addr, addressLength(addr), host, sizeof(host),
+                    NULL, 0, NI_NUMERICHOST) != 0) {
+        return "?";
+    }
+    return addr.ss_family == AF_INET6 ? "[" + std::string(host) + "]" : std::string(host);
+}
+
+// One destination, driven by a single non-blocking epoll loop on its own I/O
+// thread. The loop owns the socket: it connects without blocking, writes
+// queued segments as the socket becomes writable (keeping partial writes for
+// the next EPOLLOUT) and schedules reconnects with a timerfd backoff. The
+// sender only appends segments to this destination's queue and wakes the
+// loop through an eventfd, so it never touches the socket, and a slow
+// destination only ever fills its own queue.
+class DataserverConnection {
+private:
+    enum State { IDLE, RESOLVING, CONNECTING, CONNECTED };
+
+    // A connection attempt racing the others (happy eyeballs)
+    struct Attempt {
+        int fd;
+        struct sockaddr_storage addr;
+    };
+
+    std::string server_address;
+    int server_port;
+    std::atomic<bool> connected;
+    bool compact;                   // messages carry only the packed bytes, not 128
+    OverflowPolicy policy;          // what a full queue does with new segments
+
+    // Shared between the sender and the I/O thread
+    std::mutex out_mutex;
+    std::deque<Segment> queue;
+    size_t queued_bytes;
+    std::atomic<uint64_t> overflowed;   // datapoints dropped on a full queue
+
+    // Store-and-forward: datapoints that cannot be sent go to the spool and
+    // are replayed at spool_rate per second once connected (under out_mutex)
+    Spool spool;
+    int spool_rate;
+    std::atomic<uint64_t> spooled;
+    std::atomic<uint64_t> replayed;
+    std::atomic<uint64_t> spool_dropped;
+
+    // I/O thread state
+    std::thread io_thread;
+    std::atomic<bool> running;
+    State state;
+    int sockfd;
+    int epoll_fd;
+    int wake_fd;
+    int timer_fd;
+    int replay_fd;
+    int resolve_fd;
+    int backoff_ms;
+    int peer_timeout_ms;
+
+    // Name resolution runs on a helper thread; the loop keeps the last
+    // answer and the last address that actually accepted a connection
+    std::shared_ptr<ResolveJob> resolve_job;
+    std::vector<struct sockaddr_storage> addresses;
+    std::chrono::steady_clock::time_point resolved_at;
+    bool have_good;
+    struct sockaddr_storage good_addr;
+    struct sockaddr_storage peer_addr;
+
+    // Connection attempts in flight and the candidates not yet tried
+    std::vector<Attempt> attempts;
+    std::vector<struct sockaddr_storage> candidates;
+    size_t next_candidate;
+    std::chrono::steady_clock::time_point connect_deadline;
+    bool want_write;
+    std::deque<Segment> sending;    // segments taken from the queue
+    size_t sent;                    // bytes of sending.front() already written
+
+    void armTimer(int ms) {
+        struct itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        spec.it_value.tv_sec = ms / 1000;
+        spec.it_value.tv_nsec = (ms % 1000) * 1000000L;
+        timerfd_settime(timer_fd, 0, &spec, NULL);
+    }
+
+    void watchSocket(uint32_t events) {
+        struct epoll_event ev;
+        ev.events = events;
+        ev.data.fd = sockfd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, sockfd, &ev);
+    }
+
+    void armReplay(bool enable) {
+        struct itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        if (enable) {
+            spec.it_value.tv_nsec = SPOOL_REPLAY_PERIOD_MS * 1000000L;
+            spec.it_interval = spec.it_value;
+        }
+        timerfd_settime(replay_fd, 0, &spec, NULL);
+    }
+
+    // Bytes a queued datapoint occupies in the output stream
+    size_t messageLength(const char* msg) const {
+        if (!compact) {
+            return DPOINT_BINARY_FIXED_LENGTH;
+        }
+        uint16_t varlen;
+        uint32_t datalen;
+        memcpy(&varlen, msg + 1, sizeof(varlen));
+        memcpy(&datalen, msg + 15 + varlen, sizeof(datalen));
+        return 19 + varlen + datalen;
+    }
+
+    // Bytes a spooled record replays as, or 0 if it is not a whole datapoint
+    size_t spooledLength(const char* rec) const {
+        size_t len = Spool::datapointLength(rec);
+        return len > 0 && !compact ? DPOINT_BINARY_FIXED_LENGTH : len;
+    }
+
+    // Caller holds out_mutex
+    void spoolMessage(const char* msg, size_t len) {
+        spooled.fetch_add(1, std::memory_order_relaxed);
+        if (!spool.push(msg, std::min(len, (size_t)SPOOL_RECORD_SIZE))) {
+            spool_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    size_t countMessages(const Segment& seg) const {
+        size_t count = 0;
+        for (size_t pos = 0; pos < seg.size(); pos += messageLength(seg.data() + pos)) {
+            count++;
+        }
+        return count;
+    }
+
+    // Caller holds out_mutex; spools every message in the segments, skipping
+    // those the first segment had already started sending at offset 'from'
+    void spoolUnsent(const std::deque<Segment>& segs, size_t from) {
+        for (const Segment& seg : segs) {
+            size_t pos = 0;
+            while (pos < seg.size()) {
+                size_t len = messageLength(seg.data() + pos);
+                if (pos >= from) {
+                    spoolMessage(seg.data() + pos, len);
+                }
+                pos += len;
+            }
+            from = 0;
+        }
+    }
+
+    // Move a rate-limited slice of the spool behind the live data, leaving
+    // the queue at most half full so live datapoints keep flowing
+    void replaySpool() {
+        size_t budget = std::max(1, spool_rate * SPOOL_REPLAY_PERIOD_MS / 1000);
+        {
+            std::lock_guard<std::mutex> lock(out_mutex);
+            size_t room = queued_bytes < DSERV_OUTBUF_LIMIT / 2 ? DSERV_OUTBUF_LIMIT / 2 - queued_bytes : 0;
+            budget = std::min(std::min(budget, spool.size()), room / DPOINT_BINARY_FIXED_LENGTH);
+            if (budget > 0) {
+                Segment seg;
+                seg.block = std::make_shared<PackBlock>(budget * DPOINT_BINARY_FIXED_LENGTH);
+                seg.begin = seg.end = 0;
+                while (budget-- > 0) {
+                    const char* msg = spool.front();
+                    size_t len = spooledLength(msg);
+                    if (len > 0) {
+                        memcpy(seg.block->data.get() + seg.end, msg, len);
+                        seg.end += len;
+                        replayed.fetch_add(1, std::memory_order_relaxed);
+                    } else {
+                        spool_dropped.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    spool.pop();
+                }
+                if (seg.size() > 0) {
+                    queued_bytes += seg.size();
+                    queue.push_back(seg);
+                }
+            }
+        }
+        pump();
+    }
+
+    void closeAttempts() {
+        for (const Attempt& attempt : attempts) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, attempt.fd, NULL);
+            close(attempt.fd);
+        }
+        attempts.clear();
+    }
+
+    void closeSocket() {
+        armReplay(false);
+        closeAttempts();
+        if (sockfd >= 0) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sockfd, NULL);
+            close(sockfd);
+            sockfd = -1;
+        }
+        state = IDLE;
+        want_write = false;
+    }
+
+    // Retry after the current backoff, doubling it up to RECONNECT_DELAY_MS
+    void scheduleReconnect() {
+        closeSocket();
+        std::cout << "Reconnecting to " << name() << " in " << backoff_ms << " ms..." << std::endl;
+        armTimer(backoff_ms);
+        backoff_ms = std::min(backoff_ms * 2, RECONNECT_DELAY_MS);
+    }
+
+    void connectionLost(const char* reason) {
+        std::cerr << "Connection to " << name() << " lost (" << reason << "), will attempt reconnection" << std::endl;
+        {
+            // Drop anything queued so the new connection starts on a
+            // message boundary; with a spool, unsent messages are kept
+            std::lock_guard<std::mutex> lock(out_mutex);
+            connected.store(false);
+            if (spool.isOpen()) {
+                spoolUnsent(sending, sent);
+                spoolUnsent(queue, 0);
+            }
+            queue.clear();
+            queued_bytes = 0;
+        }
+        sending.clear();
+        sent = 0;
+        scheduleReconnect();
+    }
+
+    // Look the server name up on a helper thread; getaddrinfo() blocks, and
+    // for mDNS names can do so for seconds. Completion is signalled on
+    // resolve_fd.
+    void startResolve() {
+        if (resolve_job) {
+            return;
+        }
+        int notify_fd = dup(resolve_fd);
+        if (notify_fd < 0) {
+            std::cerr << "Failed to start name resolution: " << strerror(errno) << std::endl;
+            return;
+        }
+        resolve_job = std::make_shared<ResolveJob>(notify_fd);
+        std::shared_ptr<ResolveJob> job = resolve_job;
+        std::string host = server_address;
+        std::string port = std::to_string(server_port);
+        std::thread([job, host, port]() {
+            struct addrinfo hints;
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            hints.ai_flags = AI_ADDRCONFIG;
+            struct addrinfo* result = NULL;
+            int error = getaddrinfo(host.c_str(), port.c_str(), &hints, &result);
+
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->error = error;
+            for (struct addrinfo* ai = result; ai; ai = ai->ai_next) {
+                struct sockaddr_storage addr;
+                memset(&addr, 0, sizeof(addr));
+                memcpy(&addr, ai->ai_addr, ai->ai_addrlen);
+                job->addrs.push_back(addr);
+            }
+            if (result) freeaddrinfo(result);
+            job->done = true;
+            uint64_t one = 1;
+            if (write(job->notify_fd, &one, sizeof(one)) < 0) {}
+        }).detach();
+    }
+
+    void finishResolve() {
+        uint64_t count;
+        if (read(resolve_fd, &count, sizeof(count)) < 0 || !resolve_job) {
+            return;
+        }
+        std::shared_ptr<ResolveJob> job = resolve_job;
+        std::lock_guard<std::mutex> lock(job->mutex);
+        if (!job->done) {
+            return;
+        }
+        resolve_job.reset();
+
+        if (job->error != 0) {
+            // Keep whatever was resolved before; it is still the best guess
+            std::cerr << "Failed to resolve hostname " << server_address << ": "
+                      << gai_strerror(job->error) << std::endl;
+        } else {
+            // Alternate address families in the resolver's preference order,
+            // so a broken IPv6 or IPv4 path costs one attempt's head start
+            std::vector<struct sockaddr_storage> first, second;
+            for (const struct sockaddr_storage& addr : job->addrs) {
+                (addr.ss_family == job->addrs[0].ss_family ? first : second).push_back(addr);
+            }
+            addresses.clear();
+            for (size_t i = 0; i < std::max(first.size(), second.size()); ++i) {
+                if (i < first.size()) addresses.push_back(first[i]);
+                if (i < second.size()) addresses.push_back(second[i]);
+            }
+            resolved_at = std::chrono::steady_clock::now();
+        }
+
+        if (state == RESOLVING) {
+            if (addresses.empty() && !have_good) {
+                scheduleReconnect();
+            } else {
+                beginConnect();
+            }
+        }
+    }
+
+    int msUntil(std::chrono::steady_clock::time_point t) const {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            t - std::chrono::steady_clock::now()).count();
+    }
+
+    void beginConnect() {
+        // Refresh the cached addresses in the background while connecting
+        // to the ones already known
+        bool stale = addresses.empty() ||
+                     std::chrono::steady_clock::now() - resolved_at >
+                     std::chrono::milliseconds(RESOLVE_REFRESH_MS);
+        if (stale) {
+            startResolve();
+        }
+
+        // The last address that worked goes first, ahead of the resolver's list
+        candidates.clear();
+        if (have_good) {
+            candidates.push_back(good_addr);
+        }
+        for (const struct sockaddr_storage& addr : addresses) {
+            if (!have_good || !sameAddress(addr, good_addr)) {
+                candidates.push_back(addr);
+            }
+        }
+        next_candidate = 0;
+
+        if (candidates.empty()) {
+            if (resolve_job) {
+                // Nothing to try until the first lookup answers
+                state = RESOLVING;
+                armTimer(CONNECT_TIMEOUT_MS);
+            } else {
+                scheduleReconnect();
+            }
+            return;
+        }
+
+        state = CONNECTING;
+        connect_deadline = std::chrono::steady_clock::now() +
+                           std::chrono::milliseconds(CONNECT_TIMEOUT_MS);
+        startAttempt();
+    }
+
+    // Start a connection to the next candidate. Each attempt gets
+    // HAPPY_EYEBALLS_DELAY_MS to itself before the next one joins the race;
+    // the timer also bounds the whole race by CONNECT_TIMEOUT_MS.
+    void startAttempt() {
+        while (next_candidate < candidates.size()) {
+            Attempt attempt;
+            attempt.addr = candidates[next_candidate++];
+            attempt.fd = socket(attempt.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (attempt.fd < 0) {
+                std::cerr << "Failed to create socket: " << strerror(errno) << std::endl;
+                continue;
+            }
+
+            int flag = 1;
+            setsockopt(attempt.fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+            setLivenessOptions(attempt.fd);
+
+            int result = ::connect(attempt.fd, (struct sockaddr*)&attempt.addr, addressLength(attempt.addr));
+            if (result < 0 && errno != EINPROGRESS) {
+                std::cerr << "Connection to " << formatAddress(attempt.addr) << " failed: "
+                          << strerror(errno) << std::endl;
+                close(attempt.fd);
+                continue;
+            }
+
+            // Completion (or failure) is reported as EPOLLOUT
+            struct epoll_event ev;
+            ev.events = EPOLLOUT;
+            ev.data.fd = attempt.fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, attempt.fd, &ev);
+            attempts.push_back(attempt);
+            break;
+        }
+
+        if (attempts.empty()) {
+            scheduleReconnect();
+            return;
+        }
+        int remaining = std::max(1, msUntil(connect_deadline));
+        armTimer(next_candidate < candidates.size() ? std::min(HAPPY_EYEBALLS_DELAY_MS, remaining)
+                                                    : remaining);
+    }
+
+    // Bound how long a dead or stalled peer can go unnoticed: TCP_USER_TIMEOUT
+    // drops the connection when sent data stays unacknowledged, and
+    // keepalive probes cover idle periods with nothing in flight. Either
+    // surfaces as EPOLLERR on the socket.
+    void setLivenessOptions(int fd) {
+        unsigned int user_timeout = peer_timeout_ms;
+        setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, sizeof(user_timeout));
+
+        int keepalive = 1;
+        int probe_s = std::max(1, peer_timeout_ms / 4000);
+        int probes = 3;
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &keepalive, sizeof(keepalive));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &probe_s, sizeof(probe_s));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &probe_s, sizeof(probe_s));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(probes));
+    }
+
+    // An attempt's socket became writable: it either won the race or failed
+    void finishAttempt(int fd) {
+        size_t i = 0;
+        while (i < attempts.size() && attempts[i].fd != fd) ++i;
+        if (i == attempts.size()) {
+            return;
+        }
+        Attempt attempt = attempts[i];
+        attempts.erase(attempts.begin() + i);
+
+        int so_error = 0;
+        socklen_t len = sizeof(so_error);
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &so_error, &len);
+        if (so_error != 0) {
+            std::cerr << "Connection to " << formatAddress(attempt.addr) << " failed: "
+                      << strerror(so_error) << std::endl;
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            close(fd);
+            // Don't wait out the head start of an attempt that already failed
+            if (attempts.empty()) {
+                startAttempt();
+            }
+            return;
+        }
+
+        closeAttempts();
+        sockfd = fd;
+        peer_addr = attempt.addr;
+        good_addr = attempt.addr;
+        have_good = true;
+
+        armTimer(0);
+        state = CONNECTED;
+        backoff_ms = RECONNECT_MIN_DELAY_MS;
+        want_write = false;
+        watchSocket(EPOLLIN | EPOLLRDHUP);
+        connected.store(true);
+        if (spool.isOpen()) {
+            armReplay(true);
+        }
+        std::cout << "Connected to dataserver at " << server_address << ":" << server_port
+                  << " (" << formatAddress(peer_addr) << ")" << std::endl;
+    }
+
+    // Write as much queued output as the socket takes without blocking,
+    // gathering up to SEND_IOV_MAX segments into each sendmsg()
+    void pump() {
+        for (;;) {
+            if (sending.empty()) {
+                std::lock_guard<std::mutex> lock(out_mutex);
+                sending.swap(queue);
+                queued_bytes = 0;
+            }
+            if (sending.empty()) {
+                break;
+            }
+
+            struct iovec iov[SEND_IOV_MAX];
+            size_t niov = 0;
+            for (size_t i = 0; i < sending.size() && niov < SEND_IOV_MAX; ++i, ++niov) {
+                size_t skip = i == 0 ? sent : 0;
+                iov[niov].iov_base = const_cast<char*>(sending[i].data()) + skip;
+                iov[niov].iov_len = sending[i].size() - skip;
+            }
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = niov;
+
+            auto start = std::chrono::steady_clock::now();
+            ssize_t n = sendmsg(sockfd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+            send_time.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    if (!want_write) {
+                        want_write = true;
+                        watchSocket(EPOLLIN | EPOLLRDHUP | EPOLLOUT);
+                    }
+                    return;
+                }
+                connectionLost(strerror(errno));
+                return;
+            }
+            // Release the segments that went out completely
+            size_t done = n;
+            while (done > 0) {
+                size_t left = sending.front().size() - sent;
+                if (done < left) {
+                    sent += done;
+                    break;
+                }
+                done -= left;
+                sending.pop_front();
+                sent = 0;
+            }
+        }
+        if (want_write) {
+            want_write = false;
+            watchSocket(EPOLLIN | EPOLLRDHUP);
+        }
+    }
+
+    // The dataserver does not talk back; reading only detects a close
+    void drainInput() {
+        char buf[256];
+        for (;;) {
+            ssize_t n = recv(sockfd, buf, sizeof(buf), MSG_DONTWAIT);
+            if (n > 0) continue;
+            if (n == 0) {
+                connectionLost("closed by remote host");
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                connectionLost(strerror(errno));
+            }
+            return;
+        }
+    }
+
+    void run() {
+        beginConnect();
+
+        struct epoll_event events[8];
+        while (running.load()) {
+            int n = epoll_wait(epoll_fd, events, 8, -1);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                std::cerr << "epoll_wait failed: " << strerror(errno) << std::endl;
+                break;
+            }
+
+            for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+                uint32_t ev = events[i].events;
+
+                if (fd == wake_fd) {
+                    uint64_t count;
+                    if (read(wake_fd, &count, sizeof(count)) < 0) {}
+                    if (state == CONNECTED) pump();
+                } else if (fd == replay_fd) {
+                    uint64_t expirations;
+                    if (read(replay_fd, &expirations, sizeof(expirations)) < 0) continue;
+                    if (state == CONNECTED) replaySpool();
+                } else if (fd == resolve_fd) {
+                    finishResolve();
+                } else if (fd == timer_fd) {
+                    uint64_t expirations;
+                    if (read(timer_fd, &expirations, sizeof(expirations)) < 0) continue;
+                    if (state == CONNECTING && msUntil(connect_deadline) > 0) {
+                        startAttempt();
+                    } else if (state == CONNECTING) {
+                        std::cerr << "Connection timeout" << std::endl;
+                        scheduleReconnect();
+                    } else if (state == RESOLVING) {
+                        // The lookup carries on; its answer is cached for the next try
+                        std::cerr << "Name resolution timeout" << std::endl;
+                        scheduleReconnect();
+                    } else if (state == IDLE) {
+                        beginConnect();
+                    }
+                } else if (state == CONNECTING) {
+                    finishAttempt(fd);
+                } else if (fd == sockfd) {
+                    if (ev & EPOLLERR) {
+                        int so_error = 0;
+                        socklen_t len = sizeof(so_error);
+                        getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &so_error, &len);
+                        connectionLost(so_error ? strerror(so_error) : "socket error");
+                        continue;
+                    }
+                    if (ev & (EPOLLHUP | EPOLLRDHUP)) {
+                        connectionLost("closed by remote host");
+                        continue;
+                    }
+                    if (ev & EPOLLIN) drainInput();
+                    if (state == CONNECTED && (ev & EPOLLOUT)) pump();
+                }
+            }
+        }
+
+        // Whatever the socket will not take now is kept for the next run
+        if (state == CONNECTED) pump();
+        std::lock_guard<std::mutex> lock(out_mutex);
+        connected.store(false);
+        if (spool.isOpen()) {
+            spoolUnsent(sending, sent);
+            spoolUnsent(queue, 0);
+            queue.clear();
+        }
+        closeSocket();
+    }
+
+    void wake() {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            std::cerr << "Failed to wake network loop: " << strerror(errno) << std::endl;
+        }
+    }
+    
+public:
+    Histogram send_time;            // ns per sendmsg() call on the socket
+
+    DataserverConnection(const std::string& addr, int port, OverflowPolicy policy)
+        : server_address(addr), server_port(port), connected(false), compact(false),
+          policy(policy), queued_bytes(0), overflowed(0), spool_rate(DEFAULT_SPOOL_RATE),
+          spooled(0), replayed(0), spool_dropped(0), running(false), state(IDLE),
+          sockfd(-1), backoff_ms(RECONNECT_MIN_DELAY_MS), peer_timeout_ms(PEER_TIMEOUT_MS),
+          have_good(false), next_candidate(0), want_write(false), sent(0) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        resolve_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        replay_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = wake_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+        ev.data.fd = timer_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+        ev.data.fd = replay_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, replay_fd, &ev);
+        ev.data.fd = resolve_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, resolve_fd, &ev);
+    }
+    
+    ~DataserverConnection() {
+        stop();
+        close(resolve_fd);
+        close(replay_fd);
+        close(timer_fd);
+        close(wake_fd);
+        close(epoll_fd);
+    }
+    
+    // Start the I/O thread, which connects and keeps reconnecting
+    bool start() {
+        if (epoll_fd < 0 || wake_fd < 0 || timer_fd < 0 || replay_fd < 0 || resolve_fd < 0) {
+            std::cerr << "Failed to create network event loop: " << strerror(errno) << std::endl;
+            return false;
+        }
+        running.store(true);
+        io_thread = std::thread(&DataserverConnection::run, this);
+        return true;
+    }
+    
+    // Stop the I/O thread and close the connection
+    void stop() {
+        if (!io_thread.joinable()) {
+            return;
+        }
+        running.store(false);
+        wake();
+        io_thread.join();
+    }
+
+    std::string name() const {
+        return server_address + ":" + std::to_string(server_port);
+    }
+
+    // Longest a stalled or vanished peer can go undetected (call before start())
+    void setPeerTimeout(int timeout_ms) {
+        peer_timeout_ms = timeout_ms;
+    }
+
+    // Keep up to capacity datapoints while the dataserver is unreachable and
+    // replay them at rate per second after reconnecting. With a path the
+    // spool is a file that survives restarts (call before start()).
+    bool setSpool(size_t capacity, const std::string& path, int rate) {
+        spool_rate = rate;
+        return spool.open(capacity, path);
+    }
+
+    bool isSpooling() const {
+        return spool.isOpen();
+    }
+
+    uint64_t spooledCount() const {
+        return spooled.load(std::memory_order_relaxed);
+    }
+
+    uint64_t replayedCount() const {
+        return replayed.load(std::memory_order_relaxed);
+    }
+
+    uint64_t spoolDroppedCount() const {
+        return spool_dropped.load(std::memory_order_relaxed);
+    }
+
+    void setCompact(bool enable) {
+        compact = enable;
+    }
+
+    bool isConnected() const {
+        return connected.load();
+    }
+    
+    uint64_t overflowCount() const {
+        return overflowed.load(std::memory_order_relaxed);
+    }
+
+    // Queue segments of packed datapoints (sender thread). While
+    // disconnected they go to the spool, if there is one. A full queue
+    // drops either the new segments or the oldest queued ones, per policy.
+    void enqueue(const std::vector<Segment>& segs) {
+        {
+            std::lock_guard<std::mutex> lock(out_mutex);
+            for (const Segment& seg : segs) {
+                if (!connected.load()) {
+                    if (spool.isOpen()) {
+                        spoolUnsent(std::deque<Segment>(1, seg), 0);
+                    }
+                    continue;
+                }
+                if (policy == DROP_OLDEST) {
+                    while (!queue.empty() && queued_bytes + seg.size() > DSERV_OUTBUF_LIMIT) {
+                        overflowed.fetch_add(countMessages(queue.front()), std::memory_order_relaxed);
+                        queued_bytes -= queue.front().size();
+                        queue.pop_front();
+                    }
+                }
+                if (queued_bytes + seg.size() > DSERV_OUTBUF_LIMIT) {
+                    if (spool.isOpen()) {
+                        spoolUnsent(std::deque<Segment>(1, seg), 0);
+                    } else {
+                        overflowed.fetch_add(countMessages(seg), std::memory_order_relaxed);
+                    }
+                    continue;
+                }
+                queue.push_back(seg);
+                queued_bytes += seg.size();
+            }
+        }
+        wake();
+    }
+};
+
+#define CLOCK_CALIBRATION_MS 1000
+
+// Timestamps are taken on the bus threads from a clock that never jumps and
+// converted to dataserver time (microseconds since the epoch) on the sender
+// thread. CLOCK_MONOTONIC_RAW is mapped onto CLOCK_REALTIME by an offset
+// that is re-measured every CLOCK_CALIBRATION_MS; CLOCK_TAI needs no mapping.
+class SampleClock {
+private:
+    clockid_t source;
+    int64_t offset_ns;
+    std::chrono::steady_clock::time_point last_calibration;
+
+    static uint64_t readClock(clockid_t id) {
+        struct timespec ts;
+        clock_gettime(id, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+public:
+    SampleClock() : source(CLOCK_MONOTONIC_RAW), offset_ns(0) {
+        calibrate();
+    }
+
+    void useTai(bool tai) {
+        source = tai ? CLOCK_TAI : CLOCK_MONOTONIC_RAW;
+        calibrate();
+    }
+
+    // Read the acquisition clock (any thread)
+    uint64_t now() const {
+        return readClock(source);
+    }
+
+    // Measure the source-to-realtime offset, keeping the tightest of a few
+    // bracketed reads so a preemption between them does not skew it
+    void calibrate() {
+        last_calibration = std::chrono::steady_clock::now();
+        if (source == CLOCK_TAI) {
+            offset_ns = 0;
+            return;
+        }
+        uint64_t best_width = UINT64_MAX;
+        for (int i = 0; i < 5; ++i) {
+            uint64_t before = readClock(source);
+            uint64_t real = readClock(CLOCK_REALTIME);
+            uint64_t after = readClock(source);
+            if (after - before < best_width) {
+                best_width = after - before;
+                offset_ns = (int64_t)(real - (before + (after - before) / 2));
+            }
+        }
+    }
+
+    void calibrateIfDue() {
+        if (std::chrono::steady_clock::now() - last_calibration >=
+            std::chrono::milliseconds(CLOCK_CALIBRATION_MS)) {
+            calibrate();
+        }
+    }
+
+    // Convert an acquisition clock reading to a dataserver timestamp
+    uint64_t toMicros(uint64_t ns) const {
+        return (uint64_t)((int64_t)ns + offset_ns) / 1000;
+    }
+};
+
+// A datapoint registered once, such as grasp/sensor0/vals, with its '>'
+// message laid out in advance: the header is fixed apart from the timestamp,
+// and the template is zero padded to DPOINT_BINARY_FIXED_LENGTH. Packing is
+// then one copy of the template, the timestamp and the payload, into a
+// buffer the caller owns.
+class Datapoint {
+private:
+    char message[DPOINT_BINARY_FIXED_LENGTH];
+    uint16_t varlen;
+    uint32_t datalen;
+    size_t length;                  // packed bytes, 0 if it does not fit
+
+    size_t timestampOffset() const {
+        return sizeof(uint8_t) + sizeof(uint16_t) + varlen;
+    }
+
+    size_t payloadOffset() const {
+        return timestampOffset() + sizeof(uint64_t) + 2 * sizeof(uint32_t);
+    }
+
+public:
+    Datapoint(const std::string& varname, int dtype, int len)
+        : varlen(std::min<size_t>(varname.size(), DPOINT_BINARY_FIXED_LENGTH)), datalen(len) {
+        memset(message, 0, sizeof(message));
+        length = payloadOffset() + datalen;
+        if (length > DPOINT_BINARY_FIXED_LENGTH) {
+            length = 0;
+            return;
+        }
+
+        uint32_t datatype = dtype;
+        message[0] = DPOINT_BINARY_MSG_CHAR;
+        memcpy(&message[1], &varlen, sizeof(varlen));
+        memcpy(&message[3], varname.data(), varlen);
+        memcpy(&message[timestampOffset() + sizeof(uint64_t)], &datatype, sizeof(datatype));
+        memcpy(&message[timestampOffset() + sizeof(uint64_t) + sizeof(uint32_t)], &datalen, sizeof(datalen));
+    }
+
+    // False if the name and payload do not fit in one message
+    bool valid() const { return length != 0; }
+
+    size_t packedLength() const { return length; }
+    size_t payloadLength() const { return datalen; }
+
+    std::string name() const { return std::string(&message[3], varlen); }
+
+    // Lay out the message at buf as msg_len bytes: the packed length, or
+    // DPOINT_BINARY_FIXED_LENGTH with zero padding
+    void pack(char* buf, size_t msg_len, const void* data, uint64_t timestamp) const {
+        memcpy(buf, message, msg_len);
+        memcpy(buf + timestampOffset(), &timestamp, sizeof(timestamp));
+        memcpy(buf + payloadOffset(), data, datalen);
+    }
+};
+
+// Packs each datapoint once and fans it out to every destination: the
+// primary dataserver given with -h/-p and any number of mirrors. Each
+// destination has its own connection, I/O thread, send queue and overflow
+// policy, so a slow mirror never holds up the primary or the sender.
+class DataserverClient {
+private:
+    std::vector<std::unique_ptr<DataserverConnection> > destinations;
+    bool compact;                   // send only the packed bytes, not 128
+
+    // Batching: datapoints accumulate in the current block and are only
+    // handed to the destinations once the batch is flushed (sender thread only)
+    int coalesce_us;                // -1 disables batching
+    bool batch_open;
+    std::chrono::steady_clock::time_point batch_started;
+
+    // Packing state (sender thread only): bytes of block up to 'published'
+    // have been handed out; full blocks not yet handed out wait in 'pending'
+    std::shared_ptr<PackBlock> block;
+    size_t used;
+    size_t published;
+    std::vector<Segment> pending;
+
+    // Datagram transport for streams that would rather lose a frame than
+    // wait for a retransmit (sender thread only, apart from the counters)
+    int udp_fd;
+    uint32_t udp_seq;
+    const SampleClock* clock;       // stamps datapoints sent without a timestamp
+    std::atomic<uint64_t> udp_sent;
+    std::atomic<uint64_t> udp_dropped;
+
+    DataserverConnection& primary() const {
+        return *destinations[0];
+    }
+
+    // Timestamp 0 means now, on the same clock as the samples so that
+    // status and statistics datapoints line up with them (--clock tai)
+    uint64_t stamp(uint64_t timestamp) const {
+        if (timestamp) {
+            return timestamp;
+        }
+        if (clock) {
+            return clock->toMicros(clock->now());
+        }
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // Hand everything packed so far to every destination
+    void publish() {
+        if (block && used > published) {
+            pending.push_back(Segment{ block, published, used });
+            published = used;
+        }
+        if (pending.empty()) {
+            return;
+        }
+        for (auto& dest : destinations) {
+            dest->enqueue(pending);
+        }
+        pending.clear();
+    }
+
+    // Room for one more message, moving to a fresh block when this one is
+    // full. A block nobody else references any more is simply reused.
+    char* reserve(size_t len) {
+        if (block && used + len <= block->capacity) {
+            return block->data.get() + used;
+        }
+        if (block && used > published) {
+            pending.push_back(Segment{ block, published, used });
+        }
+        if (!block || !pending.empty() || block.use_count() > 1) {
+            block = std::make_shared<PackBlock>(PACK_BLOCK_SIZE);
+        }
+        used = published = 0;
+        return block->data.get();
+    }
+
+public:
+    Histogram pack_time;            // ns to pack one datapoint
+
+    DataserverClient(const std::string& addr, int port)
+        : compact(false), coalesce_us(-1), batch_open(false), used(0), published(0),
+          udp_fd(-1), udp_seq(0), clock(nullptr), udp_sent(0), udp_dropped(0) {
+        destinations.emplace_back(new DataserverConnection(addr, port, DROP_NEWEST));
+    }
+
+    ~DataserverClient() {
+        stop();
+        if (udp_fd >= 0) {
+            close(udp_fd);
+        }
+    }
+
+    // Send datagrams to host:port, which may be a multicast group; ttl sets
+    // how many routers multicast datagrams may cross. The name is resolved
+    // once, here.
+    bool setDatagramDestination(const std::string& host, int port, int ttl) {
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        struct addrinfo* result = NULL;
+        int error = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result);
+        if (error != 0) {
+            std::cerr << "Failed to resolve UDP destination " << host << ": " << gai_strerror(error) << std::endl;
+            return false;
+        }
+
+        udp_fd = socket(result->ai_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        bool ok = udp_fd >= 0;
+        if (ok && result->ai_family == AF_INET6) {
+            setsockopt(udp_fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof(ttl));
+        } else if (ok) {
+            setsockopt(udp_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+        }
+        // A connected datagram socket skips the per-send route lookup
+        ok = ok && ::connect(udp_fd, result->ai_addr, result->ai_addrlen) == 0;
+        if (!ok) {
+            std::cerr << "Failed to set up UDP destination " << host << ": " << strerror(errno) << std::endl;
+        }
+        freeaddrinfo(result);
+        return ok;
+    }
+
+    bool hasDatagramDestination() const {
+        return udp_fd >= 0;
+    }
+
+    uint64_t datagramsSent() const {
+        return udp_sent.load(std::memory_order_relaxed);
+    }
+
+    uint64_t datagramsDropped() const {
+        return udp_dropped.load(std::memory_order_relaxed);
+    }
+
+    // Send one datapoint as its own datagram: a uint32 sequence number, then
+    // the compact '>' message. The number advances even when a send fails,
+    // so receivers see every lost frame as a gap. Never blocks.
+    bool sendDatagram(const Datapoint& point, const void* data, uint64_t timestamp = 0) {
+        auto pack_start = std::chrono::steady_clock::now();
+        size_t total_bytes = point.packedLength();
+        if (total_bytes == 0) {
+            std::cerr << "Data too large for buffer" << std::endl;
+            return false;
+        }
+        char buf[sizeof(uint32_t) + DPOINT_BINARY_FIXED_LENGTH];
+        uint32_t seq = udp_seq++;
+        memcpy(buf, &seq, sizeof(seq));
+        point.pack(buf + sizeof(seq), total_bytes, data, stamp(timestamp));
+        pack_time.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - pack_start).count());
+
+        if (send(udp_fd, buf, sizeof(seq) + total_bytes, MSG_DONTWAIT) < 0) {
+            // A full socket buffer, or an ICMP error from the last datagram
+            udp_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        udp_sent.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Also send everything to addr:port (call before start())
+    void addDestination(const std::string& addr, int port, OverflowPolicy policy) {
+        destinations.emplace_back(new DataserverConnection(addr, port, policy));
+    }
+
+    size_t destinationCount() const {
+        return destinations.size();
+    }
+
+    const DataserverConnection& destination(size_t n) const {
+        return *destinations[n];
+    }
+
+    // Start every destination's I/O thread
+    bool start() {
+        for (auto& dest : destinations) {
+            if (!dest->start()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void stop() {
+        for (auto& dest : destinations) {
+            dest->stop();
+        }
+    }
+
+    void setPeerTimeout(int timeout_ms) {
+        for (auto& dest : destinations) {
+            dest->setPeerTimeout(timeout_ms);
+        }
+    }
+
+    // The spool only backs the primary; mirrors drop what they cannot send
+    bool setSpool(size_t capacity, const std::string& path, int rate) {
+        return primary().setSpool(capacity, path, rate);
+    }
+
+    bool isSpooling() const {
+        return primary().isSpooling();
+    }
+
+    uint64_t spooledCount() const {
+        return primary().spooledCount();
+    }
+
+    uint64_t replayedCount() const {
+        return primary().replayedCount();
+    }
+
+    uint64_t spoolDroppedCount() const {
+        return primary().spoolDroppedCount();
+    }
+
+    // Stamp untimed datapoints from the samples' clock (sender thread only)
+    void setClock(const SampleClock* sample_clock) {
+        clock = sample_clock;
+    }
+
+    // Compact framing sends each datapoint's actual length instead of padding
+    // it to DPOINT_BINARY_FIXED_LENGTH. Only dataservers that parse the
+    // message header to find its length accept this.
+    void setCompact(bool enable) {
+        compact = enable;
+        for (auto& dest : destinations) {
+            dest->setCompact(enable);
+        }
+    }
+
+    // Enable batching: datapoints are held for at most delay_us after the
+    // first one is queued (0 sends whatever one tick produced), then written
+    // with a single send(). A negative delay sends every datapoint at once.
+    void setCoalesceDelay(int delay_us) {
+        coalesce_us = delay_us;
+    }
+
+    bool isBatching() const {
+        return coalesce_us >= 0;
+    }
+
+    bool batchPending() const {
+        return batch_open;
+    }
+
+    // Microseconds until the pending batch must go out, or default_us if
+    // nothing is pending
+    int64_t batchTimeout(int64_t default_us) const {
+        if (!batch_open) {
+            return default_us;
+        }
+        int64_t age = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - batch_started).count();
+        return age >= coalesce_us ? 0 : coalesce_us - age;
+    }
+
+    // Send the pending batch if its coalescing budget has run out
+    bool flushIfDue() {
+        if (batch_open && batchTimeout(0) == 0) {
+            return flush();
+        }
+        return true;
+    }
+
+    // Hand the pending batch to the destinations
+    bool flush() {
+        if (!batch_open) {
+            return true;
+        }
+        batch_open = false;
+        publish();
+        return isConnected();
+    }
+    
+    // State of the primary dataserver
+    bool isConnected() const {
+        return primary().isConnected();
+    }
+    
+    // Datapoints dropped on full send queues, over all destinations
+    uint64_t overflowCount() const {
+        uint64_t total = 0;
+        for (const auto& dest : destinations) {
+            total += dest->overflowCount();
+        }
+        return total;
+    }
+    
+    // One-off datapoints such as statistics reports, described on the spot
+    bool writeToDataserver(const char* varname, int dtype, int len, const void* data,
+                           uint64_t timestamp = 0) {
+        return writeToDataserver(Datapoint(varname, dtype, len), data, timestamp);
+    }
+
+    // timestamp is in microseconds; 0 stamps the datapoint with the current time.
+    // Returns false if the primary dataserver is not connected, even if the
+    // datapoint was spooled or sent to a mirror.
+    bool writeToDataserver(const Datapoint& point, const void* data, uint64_t timestamp = 0) {
+        bool wanted = isSpooling();
+        for (size_t i = 0; !wanted && i < destinations.size(); ++i) {
+            wanted = destinations[i]->isConnected();
+        }
+        if (!wanted) {
+            return false;
+        }
+        
+        auto pack_start = std::chrono::steady_clock::now();
+        size_t total_bytes = point.packedLength();
+        if (total_bytes == 0) {
+            std::cerr << "Data too large for buffer" << std::endl;
+            return false;
+        }
+        
+        // Pack the data straight into the shared block
+        size_t msg_len = compact ? total_bytes : DPOINT_BINARY_FIXED_LENGTH;
+        point.pack(reserve(msg_len), msg_len, data, stamp(timestamp));
+        used += msg_len;
+        
+        pack_time.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - pack_start).count());
+        
+        if (isBatching()) {
+            if (!batch_open) {
+                batch_open = true;
+                batch_started = std::chrono::steady_clock::now();
+            }
+            return isConnected();
+        }
+        publish();
+        return isConnected();
+    }
+};
+
+#define CACHE_LINE_SIZE 64
+#define SAMPLE_RING_CAPACITY 1024
+#define DEVICE_RETRY_LIMIT 3            // back-to-back attempts at a read before quarantine
+#define DEVICE_REPROBE_MS 1000          // interval between recovery attempts
+#define DEFAULT_BURST_HOLD_MS 500       // adaptive rate: burst this long after the last activity
+#define DEFAULT_WAKE_DELTA 4            // adaptive rate: counts below baseline that start a burst
+#define RT_DEFAULT_PRIORITY 80
+#define RT_STACK_PREFAULT (256 * 1024)
+
+#ifndef MCL_ONFAULT
+#define MCL_ONFAULT 4
+#endif
+
+// Fixed-capacity single-producer/single-consumer ring. The producer and
+// consumer indices live on separate cache lines so the acquisition thread
+// and the sender thread never contend on the same line. T must be trivially
+// copyable.
+//
+// Under DROP_OLDEST the producer reclaims the oldest slot by advancing the
+// tail with a CAS; the consumer claims each item with a CAS on the same
+// index, so an item the producer reclaimed mid-copy is discarded and the
+// consumer retries.
+template <typename T, size_t Capacity>
+class SpscRing {
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+private:
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head;     // next slot to write
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail;     // next slot to read
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> dropped;
+    OverflowPolicy policy;
+    alignas(CACHE_LINE_SIZE) T slots[Capacity];
+
+public:
+    SpscRing(OverflowPolicy p = DROP_OLDEST) : head(0), tail(0), dropped(0), policy(p) {}
+
+    void setPolicy(OverflowPolicy p) { policy = p; }
+
+    // Touch every slot so the first pushes do not page-fault (call before
+    // the producer starts)
+    void prefault() {
+        memset(static_cast<void*>(slots), 0, sizeof(slots));
+    }
+
+    // Producer side
+    bool push(const T& item) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        uint64_t t = tail.load(std::memory_order_acquire);
+        if (h - t >= Capacity) {
+            if (policy == DROP_NEWEST) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            // Reclaim the oldest slot unless the consumer just took it
+            if (tail.compare_exchange_strong(t, t + 1, std::memory_order_acq_rel)) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        slots[h & (Capacity - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    bool pop(T& item) {
+        uint64_t t = tail.load(std::memory_order_acquire);
+        for (;;) {
+            uint64_t h = head.load(std::memory_order_acquire);
+            if (t == h) {
+                return false;
+            }
+            item = slots[t & (Capacity - 1)];
+            if (tail.compare_exchange_strong(t, t + 1, std::memory_order_acq_rel)) {
+                return true;
+            }
+            // Producer reclaimed this slot; t now holds the new tail
+        }
+    }
+
+    uint64_t droppedCount() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+};
+
+enum SampleKind {
+    SAMPLE_TICK,            // the tick's burst read
+    SAMPLE_IRQ,             // touch status read prompted by the IRQ line: only
+                            // data.touched is valid and seq is not consumed
+    SAMPLE_HEALTH,          // the device dropped out or came back: only
+                            // 'up' and 'dropouts' are valid
+    SAMPLE_RATE             // the bus changed its sampling rate: only 'stride'
+                            // is valid
+};
+
+// One sampled device: which sensor and tick it belongs to, when its I2C burst started
+// and finished (SampleClock nanoseconds) and the register image it returned
+struct DeviceSample {
+    int sensor;
+    uint64_t seq;           // tick number since start, shared by all buses
+    uint32_t stride;        // ticks since the bus's previous scheduled tick, or
+                            // the new ticks per sample for SAMPLE_RATE
+    uint64_t read_start;
+    uint64_t read_end;
+    SampleKind kind;
+    bool up;
+    uint32_t dropouts;
+    MPR121Sample data;
+
+    // Registers are latched while the burst is on the wire
+    uint64_t midpoint() const { return read_start + (read_end - read_start) / 2; }
+};
+
+// Fault state of one device. A device whose reads keep failing is
+// quarantined: its bus thread skips it, so the other devices keep their
+// timing, and the recovery thread owns it until a soft reset and
+// reconfiguration succeed.
+struct DeviceHealth {
+    std::atomic<bool> up;
+    std::atomic<uint64_t> recovered_at;     // SampleClock ns of the last recovery
+    std::atomic<uint32_t> dropouts;
+    std::atomic<uint32_t> recoveries;
+    bool reported_up;                       // last state sent to the consumer (bus thread)
+    bool reported;
+    std::chrono::steady_clock::time_point next_probe;   // recovery thread only
+
+    DeviceHealth() : up(true), recovered_at(0), dropouts(0), recoveries(0),
+                     reported_up(true), reported(false) {}
+};
+
+// Samples every device on one /dev/i2c-N bus from its own thread. Devices on
+// the same bus share the wires, so they are read back to back; devices on
+// different buses are read concurrently by their own BusSampler. Each bus
+// thread is the single producer of its own sample ring.
+class BusSampler {
+public:
+    std::string device;
+    int cpu;
+    std::vector<int> sensor_ids;
+    std::vector<std::unique_ptr<MPR121>> sensors;
+    std::vector<std::unique_ptr<Histogram>> i2c_time;   // ns per sensor burst
+    std::vector<std::unique_ptr<DeviceHealth>> health;
+    std::vector<std::unique_ptr<IrqLine>> irq_lines;
+    std::vector<size_t> irq_sensors;    // index into sensors for each IRQ line
+    std::thread thread;
+    SpscRing<DeviceSample, SAMPLE_RING_CAPACITY> ring;
+    std::atomic<uint64_t> overruns;     // wakeups that found more than one expiration
+    std::atomic<uint64_t> skipped;      // ticks never sampled
+    std::atomic<uint64_t> sampled;      // ticks sampled
+    std::atomic<uint64_t> irq_reads;    // status reads prompted by an IRQ edge
+    std::atomic<uint64_t> bursts;       // adaptive rate: switches from idle to burst
+    Histogram wakeup_latency;           // ns from deadline to wakeup
+
+    BusSampler(const std::string& dev) : device(dev), cpu(-1), overruns(0), skipped(0), sampled(0),
+                                         irq_reads(0), bursts(0) {}
+};
+
+// A configurable set of MPR121s spread over one or more I2C buses. Each bus
+// is sampled by a dedicated thread pinned to a core, and all bus threads are
+// driven by absolute timerfd deadlines from one shared epoch so a tick's
+// samples from different buses fall in the same window. Samples are handed
+// to a single consumer through per-bus SPSC rings; an eventfd wakes the
+// consumer once per bus tick.
+class SensorGroup {
+private:
+    std::vector<std::unique_ptr<BusSampler>> buses;
+    std::vector<std::pair<std::string, uint8_t>> devices;
+    struct IrqPin {
+        std::string device;
+        uint8_t addr;
+        std::string chip;
+        unsigned int offset;
+    };
+    std::vector<IrqPin> irq_pins;
+    std::atomic<bool> active;
+    std::atomic<bool> failed;
+    std::thread recovery;
+    OverflowPolicy overflow_policy;
+    int wake_fd;
+    size_t next_bus;
+    SampleClock sample_clock;
+    int rt_priority;                    // SCHED_FIFO priority for bus threads, 0 = off
+    bool simulated;
+    SimOptions sim_options;
+    int idle_stride;                    // adaptive rate: ticks per idle sample, 1 = off
+    int hold_ticks;                     // adaptive rate: ticks to burst after activity
+    int wake_delta;
+
+    BusSampler* findBus(const std::string& device) {
+        for (auto& bus : buses) {
+            if (bus->device == device) return bus.get();
+        }
+        return nullptr;
+    }
+
+    BusSampler* getBus(const std::string& device) {
+        BusSampler* bus = findBus(device);
+        if (!bus) {
+            buses.emplace_back(new BusSampler(device));
+            bus = buses.back().get();
+            bus->ring.setPolicy(overflow_policy);
+        }
+        return bus;
+    }
+
+    // Switch the calling bus thread to SCHED_FIFO and fault in its stack.
+    // Without the privilege the thread keeps running under the normal
+    // scheduler.
+    void enterRealtime(BusSampler* bus) {
+        struct sched_param param;
+        param.sched_priority = rt_priority;
+        int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (rc != 0) {
+            std::cerr << "Warning: SCHED_FIFO unavailable for " << bus->device << " sampler ("
+                      << strerror(rc) << "), continuing with normal scheduling" << std::endl;
+        }
+
+        volatile char stack[RT_STACK_PREFAULT];
+        for (size_t i = 0; i < sizeof(stack); i += 4096) {
+            stack[i] = 0;
+        }
+    }
+
+    void run(BusSampler* bus, struct timespec epoch, int interval_ms) {
+        if (rt_priority > 0) {
+            enterRealtime(bus);
+        }
+
+        int timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+        if (timer_fd < 0) {
+            std::cerr << "Failed to create timer for " << bus->device << ": " << strerror(errno) << std::endl;
+            failed.store(true);
+            return;
+        }
+
+        struct itimerspec timer_spec;
+        timer_spec.it_value = epoch;
+        timer_spec.it_interval.tv_sec = interval_ms / 1000;
+        timer_spec.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+
+        if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &timer_spec, NULL) < 0) {
+            std::cerr << "Failed to set timer for " << bus->device << ": " << strerror(errno) << std::endl;
+            close(timer_fd);
+            failed.store(true);
+            return;
+        }
+
+        // The kernel advances an absolute periodic timer from the epoch, so
+        // deadlines never drift; the expiration count says how many of them
+        // passed since the last wakeup. Tick numbers double as sample
+        // sequence numbers and line up across buses.
+        uint64_t epoch_ns = (uint64_t)epoch.tv_sec * 1000000000ULL + epoch.tv_nsec;
+        uint64_t interval_ns = interval_ms * 1000000ULL;
+        uint64_t tick = 0;
+
+        // With an adaptive rate the timer fires every 'stride' ticks of the
+        // same grid: 1 while bursting, idle_stride while idle. Every bus
+        // starts bursting and idles on multiples of idle_stride, so idle
+        // samples still line up across buses.
+        uint64_t stride = 1;
+        uint64_t last_slot = 0;
+        uint64_t last_active = 0;
+        if (idle_stride > 1) {
+            reportRate(bus, stride, tick);
+        }
+
+        // IRQ lines share the wait with the timer: a touch change is read
+        // and handed on at once, between ticks
+        std::vector<struct pollfd> pfds(1 + bus->irq_lines.size());
+        pfds[0].fd = timer_fd;
+        pfds[0].events = POLLIN;
+        for (size_t i = 0; i < bus->irq_lines.size(); ++i) {
+            pfds[i + 1].fd = bus->irq_lines[i]->fd();
+            pfds[i + 1].events = POLLIN;
+        }
+
+        while (active.load()) {
+            if (poll(pfds.data(), pfds.size(), -1) < 0) {
+                if (errno == EINTR) continue; // Interrupted by signal
+                std::cerr << "Sampler poll error: " << strerror(errno) << std::endl;
+                failed.store(true);
+                break;
+            }
+
+            bool irq = false;
+            bool touched = false;
+            for (size_t i = 0; i < bus->irq_lines.size(); ++i) {
+                if (pfds[i + 1].revents & POLLIN) {
+                    touched |= sampleTouchStatus(bus, i, tick);
+                    irq = true;
+                }
+            }
+            if (failed.load()) break;
+
+            // A touch reported by the IRQ line ends an idle period at once:
+            // burst from the next tick after now
+            if (touched && stride > 1) {
+                // Re-arming drops any expiration still pending on the timer.
+                // Those idle ticks came due but are not sampled any more, so
+                // count them as skipped and let the next sample's seqgap
+                // report them.
+                if (pfds[0].revents & POLLIN) {
+                    uint64_t pending = 0;
+                    if (read(timer_fd, &pending, sizeof(pending)) < 0 && errno != EINTR) {
+                        std::cerr << "Timer read error: " << strerror(errno) << std::endl;
+                        failed.store(true);
+                        break;
+                    }
+                    if (pending > 0) {
+                        bus->skipped.fetch_add(pending * stride, std::memory_order_relaxed);
+                        last_slot = tick + (pending - 1) * stride;
+                    }
+                }
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+                uint64_t next = now_ns > epoch_ns ? (now_ns - epoch_ns) / interval_ns + 1 : 0;
+                tick = std::max(next, last_slot + 1);
+                stride = 1;
+                last_active = tick;
+                if (!setRate(bus, timer_fd, epoch_ns, interval_ns, tick, stride)) break;
+                continue;
+            }
+            if (!(pfds[0].revents & POLLIN)) {
+                if (irq) wakeSender();
+                continue;
+            }
+
+            // Timer expired
+            uint64_t timer_expirations;
+            ssize_t bytes_read = read(timer_fd, &timer_expirations, sizeof(timer_expirations));
+
+            if (bytes_read < 0) {
+                if (errno == EINTR) continue; // Interrupted by signal
+                std::cerr << "Timer read error: " << strerror(errno) << std::endl;
+                failed.store(true);
+                break;
+            }
+
+            // Lateness against the most recent deadline this wakeup covers
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            uint64_t deadline = epoch_ns + (tick + (timer_expirations - 1) * stride) * interval_ns;
+            uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+            bus->wakeup_latency.record(now_ns > deadline ? now_ns - deadline : 0);
+
+            // Sample only the most recent tick this wakeup covers. A missed
+            // conversion cannot be read after the fact, so the ticks before
+            // it are skipped and show up as a seqgap.
+            if (timer_expirations > 1) {
+                bus->overruns.fetch_add(1, std::memory_order_relaxed);
+                bus->skipped.fetch_add((timer_expirations - 1) * stride, std::memory_order_relaxed);
+                tick += (timer_expirations - 1) * stride;
+                last_slot = tick - stride;
+            }
+
+            bool active_now = sampleBus(bus, tick, tick > last_slot ? tick - last_slot : 1);
+            last_slot = tick;
+            tick += stride;
+            bus->sampled.fetch_add(1, std::memory_order_relaxed);
+            if (failed.load()) break;
+
+            if (idle_stride > 1) {
+                if (active_now) {
+                    last_active = last_slot;
+                }
+                if (active_now && stride > 1) {
+                    stride = 1;
+                    tick = last_slot + 1;
+                    if (!setRate(bus, timer_fd, epoch_ns, interval_ns, tick, stride)) break;
+                } else if (stride == 1 && last_slot >= last_active + hold_ticks) {
+                    stride = idle_stride;
+                    tick = (last_slot / stride + 1) * stride;
+                    if (!setRate(bus, timer_fd, epoch_ns, interval_ns, tick, stride)) break;
+                }
+            }
+            wakeSender();
+        }
+
+        close(timer_fd);
+    }
+
+    // Move the bus timer onto every stride-th tick starting at 'first', and
+    // tell the consumer
+    bool setRate(BusSampler* bus, int timer_fd, uint64_t epoch_ns, uint64_t interval_ns,
+                 uint64_t first, uint64_t stride) {
+        uint64_t start_ns = epoch_ns + first * interval_ns;
+        uint64_t period_ns = stride * interval_ns;
+        struct itimerspec timer_spec;
+        timer_spec.it_value.tv_sec = start_ns / 1000000000ULL;
+        timer_spec.it_value.tv_nsec = start_ns % 1000000000ULL;
+        timer_spec.it_interval.tv_sec = period_ns / 1000000000ULL;
+        timer_spec.it_interval.tv_nsec = period_ns % 1000000000ULL;
+        if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &timer_spec, NULL) < 0) {
+            std::cerr << "Failed to set timer for " << bus->device << ": " << strerror(errno) << std::endl;
+            failed.store(true);
+            return false;
+        }
+        if (stride == 1) {
+            bus->bursts.fetch_add(1, std::memory_order_relaxed);
+        }
+        reportRate(bus, stride, first);
+        return true;
+    }
+
+    void reportRate(BusSampler* bus, uint64_t stride, uint64_t tick) {
+        DeviceSample event;
+        memset(&event.data, 0, sizeof(event.data));
+        event.seq = tick;
+        event.stride = stride;
+        event.read_start = event.read_end = sample_clock.now();
+        event.kind = SAMPLE_RATE;
+        for (size_t i = 0; i < bus->sensors.size(); ++i) {
+            event.sensor = bus->sensor_ids[i];
+            bus->ring.push(event);
+        }
+        wakeSender();
+    }
+
+    // Whether a sample shows contact: a touch bit, or a channel more than
+    // wake_delta counts below its baseline
+    bool isActive(const MPR121Sample& data) const {
+        if (data.touched & 0x1FFF) {
+            return true;
+        }
+        int32_t deepest = 0;
+        for (int i = 0; i < MPR121_NCHANNELS; ++i) {
+            deepest = std::max(deepest, (int32_t)(data.baseline[i] << 2) - data.filtered[i]);
+        }
+        return deepest > wake_delta;
+    }
+
+    void wakeSender() {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            std::cerr << "Failed to signal sender: " << strerror(errno) << std::endl;
+        }
+    }
+
+    // Read the touch status of the device behind IRQ line n, which also
+    // releases the line
+    // A quarantined device's edges are drained and ignored; its line is
+    // rearmed once the device is back. Returns whether any electrode is
+    // touched.
+    bool sampleTouchStatus(BusSampler* bus, size_t n, uint64_t tick) {
+        size_t i = bus->irq_sensors[n];
+        bus->irq_lines[n]->acknowledge();
+        if (!bus->health[i]->reported_up) {
+            return false;
+        }
+
+        DeviceSample sample;
+        memset(&sample.data, 0, sizeof(sample.data));
+        sample.sensor = bus->sensor_ids[i];
+        sample.seq = tick;
+        sample.stride = 0;
+        sample.kind = SAMPLE_IRQ;
+        sample.read_start = sample_clock.now();
+        uint16_t status = 0;
+        bool ok = false;
+        for (int attempt = 0; !ok && attempt < DEVICE_RETRY_LIMIT; ++attempt) {
+            ok = bus->sensors[i]->touchStatus(status);
+        }
+        sample.read_end = sample_clock.now();
+        sample.data.touched = status;
+        if (!ok) {
+            quarantine(bus, i, sample.read_end);
+            return false;
+        }
+        bus->irq_lines[n]->rearm();
+        bus->irq_reads.fetch_add(1, std::memory_order_relaxed);
+        bus->ring.push(sample);
+        return (status & 0x1FFF) != 0;
+    }
+
+    // Tell the consumer a device dropped out or came back (bus thread only)
+    void reportHealth(BusSampler* bus, size_t i, bool up, uint64_t when) {
+        DeviceHealth& health = *bus->health[i];
+        DeviceSample event;
+        memset(&event.data, 0, sizeof(event.data));
+        event.sensor = bus->sensor_ids[i];
+        event.seq = 0;
+        event.stride = 0;
+        event.read_start = event.read_end = when;
+        event.kind = SAMPLE_HEALTH;
+        event.up = up;
+        event.dropouts = health.dropouts.load();
+        bus->ring.push(event);
+        health.reported_up = up;
+        health.reported = true;
+    }
+
+    void quarantine(BusSampler* bus, size_t i, uint64_t when) {
+        DeviceHealth& health = *bus->health[i];
+        std::cerr << "Sensor " << bus->sensor_ids[i] << " on " << bus->device << " failed "
+                  << DEVICE_RETRY_LIMIT << " reads in a row, quarantined" << std::endl;
+        health.dropouts.fetch_add(1);
+        health.next_probe = std::chrono::steady_clock::now();
+        health.up.store(false);     // hands the device to the recovery thread
+        reportHealth(bus, i, false, when);
+    }
+
+    // Read every device for one tick; returns whether any of them shows
+    // activity (only computed with an adaptive rate)
+    bool sampleBus(BusSampler* bus, uint64_t tick, uint64_t stride) {
+        const SampleClock& clock = sample_clock;
+        bool active = false;
+        DeviceSample sample;
+        sample.seq = tick;
+        sample.stride = stride;
+        sample.kind = SAMPLE_TICK;
+        for (size_t i = 0; i < bus->sensors.size(); ++i) {
+            DeviceHealth& health = *bus->health[i];
+            if (!health.up.load()) {
+                continue;
+            }
+            if (!health.reported || !health.reported_up) {
+                reportHealth(bus, i, true, health.reported ? health.recovered_at.load() : clock.now());
+                for (size_t n = 0; n < bus->irq_lines.size(); ++n) {
+                    if (bus->irq_sensors[n] == i) bus->irq_lines[n]->rearm();
+                }
+            }
+
+            sample.sensor = bus->sensor_ids[i];
+            sample.read_start = clock.now();
+            bool ok = false;
+            for (int attempt = 0; !ok && attempt < DEVICE_RETRY_LIMIT; ++attempt) {
+                ok = bus->sensors[i]->sample(sample.data);
+            }
+            sample.read_end = clock.now();
+            bus->i2c_time[i]->record(sample.read_end - sample.read_start);
+            if (!ok) {
+                quarantine(bus, i, sample.read_end);
+                continue;
+            }
+            if (idle_stride > 1 && !active) {
+                active = isActive(sample.data);
+            }
+            bus->ring.push(sample);
+        }
+        return active;
+    }
+
+    // Soft reset and reconfigure quarantined devices every
+    // DEVICE_REPROBE_MS until they answer again
+    void recover() {
+        while (active.load()) {
+            auto now = std::chrono::steady_clock::now();
+            for (auto& bus : buses) {
+                for (size_t i = 0; i < bus->sensors.size(); ++i) {
+                    DeviceHealth& health = *bus->health[i];
+                    if (health.up.load() || now < health.next_probe) {
+                        continue;
+                    }
+                    health.next_probe = now + std::chrono::milliseconds(DEVICE_REPROBE_MS);
+                    if (bus->sensors[i]->recover()) {
+                        std::cerr << "Sensor " << bus->sensor_ids[i] << " on " << bus->device
+                                  << " recovered" << std::endl;
+                        health.recoveries.fetch_add(1);
+                        health.recovered_at.store(sample_clock.now());
+                        health.up.store(true);
+                    }
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+public:
+    SensorGroup() : active(false), failed(false), overflow_policy(DROP_OLDEST), next_bus(0),
+                    rt_priority(0), simulated(false), idle_stride(1),
+                    hold_ticks(0), wake_delta(DEFAULT_WAKE_DELTA) {
+        wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    }
+
+    ~SensorGroup() {
+        stop();
+        if (wake_fd >= 0) {
+            close(wake_fd);
+        }
+    }
+
+    void setOverflowPolicy(OverflowPolicy policy) {
+        overflow_policy = policy;
+        for (auto& bus : buses) {
+            bus->ring.setPolicy(policy);
+        }
+    }
+
+    // Each chip may be registered once: two MPR121 objects on the same
+    // address would configure it concurrently and publish it twice
+    bool hasDevice(const std::string& device, uint8_t addr) const {
+        return std::find(devices.begin(), devices.end(), std::make_pair(device, addr)) != devices.end();
+    }
+
+    // Register a device; sensors are numbered in the order they are added
+    int addDevice(const std::string& device, uint8_t addr) {
+        int id = devices.size();
+        devices.push_back(std::make_pair(device, addr));
+        BusSampler* bus = getBus(device);
+        bus->sensor_ids.push_back(id);
+        bus->sensors.emplace_back(new MPR121(addr));
+        bus->i2c_time.emplace_back(new Histogram());
+        bus->health.emplace_back(new DeviceHealth());
+        return id;
+    }
+
+    // Serve every device from a simulated MPR121 instead of /dev/i2c-N
+    void setSimulated(const SimOptions& options) {
+        simulated = true;
+        sim_options = options;
+    }
+
+    // Watch a device's IRQ output on a GPIO line; the device is matched at
+    // begin(), so it may be added later
+    void setIrqLine(const std::string& device, uint8_t addr, const std::string& chip, unsigned int offset) {
+        irq_pins.push_back(IrqPin{ device, addr, chip, offset });
+    }
+
+    void setChannels(int id, uint16_t mask, bool baseline) {
+        sensor(id)->setChannels(mask, baseline);
+    }
+
+    // Sample each bus every idle_stride ticks while it is quiet, and every
+    // tick from the first touch or wake_delta excursion until hold_ticks
+    // ticks after the last one. Activity is judged against the chip's
+    // baselines, so the devices must be reading them.
+    void setAdaptiveRate(int idle, int hold, int delta) {
+        idle_stride = idle;
+        hold_ticks = hold;
+        wake_delta = delta;
+    }
+
+    // Run bus threads under SCHED_FIFO at the given priority (0 = off)
+    void setRealtime(int priority) {
+        rt_priority = priority;
+    }
+
+    void setBusCpu(const std::string& device, int cpu) {
+        getBus(device)->cpu = cpu;
+    }
+
+    size_t size() const { return devices.size(); }
+    const std::string& deviceBus(int id) const { return devices[id].first; }
+    uint8_t deviceAddress(int id) const { return devices[id].second; }
+
+    MPR121* sensor(int id) {
+        BusSampler* bus = findBus(devices[id].first);
+        for (size_t i = 0; i < bus->sensor_ids.size(); ++i) {
+            if (bus->sensor_ids[i] == id) return bus->sensors[i].get();
+        }
+        return nullptr;
+    }
+
+    // Bring every device up at once, one thread each. Devices on the same
+    // bus still take turns on the wires, but their waits for the first
+    // conversion overlap. A device that fails is reset and tried again, up
+    // to DEVICE_RETRY_LIMIT times.
+    bool begin() {
+        auto started = std::chrono::steady_clock::now();
+        std::vector<SimI2CBackend*> models;
+        for (size_t id = 0; id < devices.size(); ++id) {
+            if (simulated) {
+                models.push_back(new SimI2CBackend(sim_options, devices[id].second * 7919 + id));
+                sensor(id)->setBackend(models.back());
+            }
+        }
+
+        std::unique_ptr<bool[]> found(new bool[devices.size()]);
+        std::vector<std::thread> threads;
+        for (size_t id = 0; id < devices.size(); ++id) {
+            threads.emplace_back([this, id, &found]() {
+                found[id] = sensor(id)->begin(devices[id].first.c_str());
+                for (int attempt = 1; !found[id] && attempt < DEVICE_RETRY_LIMIT; ++attempt) {
+                    found[id] = sensor(id)->recover();
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        // A chip that does not answer starts out quarantined, so the others
+        // stream while the recovery thread keeps probing it. Only a bus that
+        // cannot be opened, or no device at all, stops the forwarder.
+        size_t up = 0;
+        for (size_t id = 0; id < devices.size(); ++id) {
+            if (!sensor(id)->isOpen()) {
+                return false;
+            }
+            if (!found[id]) {
+                std::cerr << "MPR121 sensor " << id << " (0x" << std::hex << (int)devices[id].second
+                          << std::dec << " on " << devices[id].first << ") not found, quarantined" << std::endl;
+                BusSampler* bus = findBus(devices[id].first);
+                size_t i = std::find(bus->sensor_ids.begin(), bus->sensor_ids.end(), (int)id) - bus->sensor_ids.begin();
+                DeviceHealth& health = *bus->health[i];
+                health.dropouts.store(1);
+                health.next_probe = std::chrono::steady_clock::now() + std::chrono::milliseconds(DEVICE_REPROBE_MS);
+                health.up.store(false);
+                reportHealth(bus, i, false, sample_clock.now());
+                continue;
+            }
+            std::cout << "MPR121[" << id << "] found!"
+                      << (sensor(id)->configured() ? " (already configured)" : "") << std::endl;
+            ++up;
+        }
+        if (up == 0) {
+            std::cerr << "No MPR121 sensor answered" << std::endl;
+            return false;
+        }
+        std::cout << "Initialized " << up << " of " << devices.size() << " device(s) in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - started).count() << " ms" << std::endl;
+
+        // A simulated device raises its IRQ from the model instead of a GPIO
+        for (const IrqPin& pin : irq_pins) {
+            size_t id = 0;
+            while (id < devices.size() && devices[id] != std::make_pair(pin.device, pin.addr)) ++id;
+            if (id == devices.size()) {
+                std::cerr << "No MPR121 at 0x" << std::hex << (int)pin.addr << std::dec
+                          << " on " << pin.device << " for its IRQ line" << std::endl;
+                return false;
+            }
+            BusSampler* bus = findBus(pin.device);
+            size_t index = std::find(bus->sensor_ids.begin(), bus->sensor_ids.end(), (int)id) - bus->sensor_ids.begin();
+            if (simulated) {
+                bus->irq_lines.emplace_back(new SimIrqLine(models[id]->model()));
+                std::cout << "MPR121[" << id << "] IRQ simulated" << std::endl;
+            } else {
+                std::unique_ptr<GpioIrqLine> line(new GpioIrqLine());
+                if (!line->open(pin.chip, pin.offset)) {
+                    return false;
+                }
+                bus->irq_lines.emplace_back(line.release());
+                std::cout << "MPR121[" << id << "] IRQ on " << pin.chip << " line " << pin.offset << std::endl;
+            }
+            bus->irq_sensors.push_back(index);
+        }
+        return true;
+    }
+
+    bool start(int interval_ms) {
+        if (wake_fd < 0) {
+            std::cerr << "Failed to create sample eventfd: " << strerror(errno) << std::endl;
+            return false;
+        }
+
+
+        // Shared epoch: first deadline one interval from now for every bus
+        struct timespec epoch;
+        clock_gettime(CLOCK_MONOTONIC, &epoch);
+        epoch.tv_sec += interval_ms / 1000;
+        epoch.tv_nsec += (interval_ms % 1000) * 1000000L;
+        if (epoch.tv_nsec >= 1000000000L) {
+            epoch.tv_sec++;
+            epoch.tv_nsec -= 1000000000L;
+        }
+
+        if (rt_priority > 0) {
+            for (auto& bus : buses) {
+                bus->ring.prefault();
+            }
+        }
+
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        active.store(true);
+        failed.store(false);
+        recovery = std::thread(&SensorGroup::recover, this);
+        for (size_t i = 0; i < buses.size(); ++i) {
+            BusSampler* bus = buses[i].get();
+            bus->thread = std::thread(&SensorGroup::run, this, bus, epoch, interval_ms);
+
+            // Default placement keeps core 0 free for the kernel and network
+            int cpu = bus->cpu >= 0 ? bus->cpu : (ncpus > 1 ? (int)((i + 1) % ncpus) : -1);
+            if (cpu >= 0) {
+                cpu_set_t cpuset;
+                CPU_ZERO(&cpuset);
+                CPU_SET(cpu, &cpuset);
+                int rc = pthread_setaffinity_np(bus->thread.native_handle(), sizeof(cpuset), &cpuset);
+                if (rc != 0) {
+                    std::cerr << "Failed to pin " << bus->device << " sampler to CPU " << cpu
+                              << ": " << strerror(rc) << std::endl;
+                }
+            }
+            std::cout << "Sampling " << bus->sensors.size() << " device(s) on " << bus->device;
+            if (cpu >= 0) std::cout << " (CPU " << cpu << ")";
+            std::cout << std::endl;
+        }
+        return true;
+    }
+
+    void stop() {
+        active.store(false);
+        for (auto& bus : buses) {
+            if (bus->thread.joinable()) {
+                bus->thread.join();
+            }
+        }
+        if (recovery.joinable()) {
+            recovery.join();
+        }
+    }
+
+    bool hasFailed() const { return failed.load(); }
+
+    // Bus threads only read the clock; calibration happens on the consumer
+    SampleClock& clock() { return sample_clock; }
+
+    // Consumer side: block until a bus thread signals new samples or the
+    // timeout (in microseconds) passes
+    bool waitForSamples(int64_t timeout_us) {
+        struct pollfd pfd;
+        pfd.fd = wake_fd;
+        pfd.events = POLLIN;
+        struct timespec timeout;
+        timeout.tv_sec = timeout_us / 1000000;
+        timeout.tv_nsec = (timeout_us % 1000000) * 1000;
+        if (ppoll(&pfd, 1, &timeout, NULL) <= 0) {
+            return false;
+        }
+        uint64_t count;
+        return read(wake_fd, &count, sizeof(count)) == sizeof(count);
+    }
+
+    // Consumer side: take the next queued sample, visiting buses in turn
+    bool pop(DeviceSample& sample) {
+        for (size_t n = 0; n < buses.size(); ++n) {
+            BusSampler* bus = buses[next_bus].get();
+            next_bus = (next_bus + 1) % buses.size();
+            if (bus->ring.pop(sample)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t busCount() const { return buses.size(); }
+    const std::string& busDevice(size_t n) const { return buses[n]->device; }
+    const Histogram& wakeupLatency(size_t n) const { return buses[n]->wakeup_latency; }
+
+    const Histogram& i2cTime(int id) const {
+        const BusSampler* bus = buses[0].get();
+        for (auto& b : buses) {
+            if (b->device == devices[id].first) bus = b.get();
+        }
+        for (size_t i = 0; i < bus->sensor_ids.size(); ++i) {
+            if (bus->sensor_ids[i] == id) return *bus->i2c_time[i];
+        }
+        return *bus->i2c_time[0];
+    }
+
+    uint64_t overrunCount() const {
+        uint64_t total = 0;
+        for (auto& bus : buses) {
+            total += bus->overruns.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    // Ticks sampled by the busiest bus thread
+    uint64_t sampledTicks() const {
+        uint64_t most = 0;
+        for (auto& bus : buses) {
+            most = std::max<uint64_t>(most, bus->sampled.load(std::memory_order_relaxed));
+        }
+        return most;
+    }
+
+    uint64_t irqReads() const {
+        uint64_t total = 0;
+        for (auto& bus : buses) {
+            total += bus->irq_reads.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    bool hasIrqLines() const { return !irq_pins.empty(); }
+
+    bool isUp(int id) const {
+        const BusSampler* bus = buses[0].get();
+        for (auto& b : buses) {
+            if (b->device == devices[id].first) bus = b.get();
+        }
+        for (size_t i = 0; i < bus->sensor_ids.size(); ++i) {
+            if (bus->sensor_ids[i] == id) return bus->health[i]->up.load();
+        }
+        return false;
+    }
+
+    bool isAdaptive() const { return idle_stride > 1; }
+
+    uint64_t burstCount() const {
+        uint64_t total = 0;
+        for (auto& bus : buses) {
+            total += bus->bursts.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    uint64_t dropoutCount() const {
+        uint64_t total = 0;
+        for (auto& bus : buses) {
+            for (auto& health : bus->health) total += health->dropouts.load();
+        }
+        return total;
+    }
+
+    uint64_t recoveryCount() const {
+        uint64_t total = 0;
+        for (auto& bus : buses) {
+            for (auto& health : bus->health) total += health->recoveries.load();
+        }
+        return total;
+    }
+
+    // Devices currently quarantined
+    size_t downCount() const {
+        size_t total = 0;
+        for (auto& bus : buses) {
+            for (auto& health : bus->health) total += !health->up.load();
+        }
+        return total;
+    }
+
+    uint64_t skippedTicks() const {
+        uint64_t total = 0;
+        for (auto& bus : buses) {
+            total += bus->skipped.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    uint64_t droppedSamples() const {
+        uint64_t total = 0;
+        for (auto& bus : buses) {
+            total += bus->ring.droppedCount();
+        }
+        return total;
+    }
+};
+
+// Parse a "<bus>:<addr>" device spec such as "1:0x5A" or "/dev/i2c-3:0x5C"
+bool parseDeviceSpec(const std::string& spec, std::string& device, uint8_t& addr) {
+    size_t colon = spec.rfind(':');
+    if (colon == std::string::npos || colon == 0) return false;
+
+    std::string bus = spec.substr(0, colon);
+    char* end;
+    long a = strtol(spec.c_str() + colon + 1, &end, 0);
+    if (*end != '\0' || a < MPR121_I2CADDR_DEFAULT || a > MPR121_I2CADDR_MAX) return false;
+
+    device = (bus[0] == '/') ? bus : "/dev/i2c-" + bus;
+    addr = a;
+    return true;
+}
+
+// Parse a "<bus>:<cpu>" bus thread placement
+bool parseCpuSpec(const std::string& spec, std::string& device, int& cpu) {
+    size_t colon = spec.rfind(':');
+    if (colon == std::string::npos || colon == 0) return false;
+
+    std::string bus = spec.substr(0, colon);
+    char* end;
+    long c = strtol(spec.c_str() + colon + 1, &end, 10);
+    if (*end != '\0' || c < 0 || c >= CPU_SETSIZE) return false;
+
+    device = (bus[0] == '/') ? bus : "/dev/i2c-" + bus;
+    cpu = c;
+    return true;
+}
+
+// Parse an IRQ wiring "<bus>:<addr>@<chip>:<line>" such as "1:0x5A@0:17";
+// the chip is a gpiochip number or a /dev path
+bool parseIrqSpec(const std::string& spec, std::string& device, uint8_t& addr,
+                  std::string& chip, unsigned int& offset) {
+    size_t at = spec.find('@');
+    if (at == std::string::npos || !parseDeviceSpec(spec.substr(0, at), device, addr)) return false;
+
+    std::string pin = spec.substr(at + 1);
+    size_t colon = pin.rfind(':');
+    if (colon == std::string::npos || colon == 0) return false;
+
+    char* end;
+    long line = strtol(pin.c_str() + colon + 1, &end, 10);
+    if (*end != '\0' || line < 0 || line > 0xFFFF) return false;
+
+    std::string name = pin.substr(0, colon);
+    chip = (name[0] == '/') ? name : "/dev/gpiochip" + name;
+    offset = line;
+    return true;
+}
+
+// Parse a mirror destination "<host>[:<port>][,drop-oldest|drop-newest]";
+// IPv6 literals with a port go in brackets
+bool parseDestinationSpec(const std::string& spec, std::string& host, int& port,
+                          OverflowPolicy& policy) {
+    std::string addr = spec;
+    size_t comma = spec.find(',');
+    if (comma != std::string::npos) {
+        std::string name = spec.substr(comma + 1);
+        if (name == "drop-oldest") policy = DROP_OLDEST;
+        else if (name == "drop-newest") policy = DROP_NEWEST;
+        else return false;
+        addr = spec.substr(0, comma);
+    }
+
+    size_t colon = addr.rfind(':');
+    bool has_port = colon != std::string::npos &&
+                    (addr[0] == '[' ? colon > 0 && addr[colon - 1] == ']' : addr.find(':') == colon);
+    if (has_port) {
+        char* end;
+        long p = strtol(addr.c_str() + colon + 1, &end, 10);
+        if (*end != '\0' || p < 1 || p > 65535) return false;
+        port = p;
+        addr = addr.substr(0, colon);
+    }
+    if (addr.size() > 2 && addr[0] == '[' && addr[addr.size() - 1] == ']') {
+        addr = addr.substr(1, addr.size() - 2);
+    }
+    host = addr;
+    return !host.empty();
+}
+
+// Load devices from a config file. Each non-comment line is either
+//   device <bus>:<addr>
+//   cpu <bus>:<core>
+bool loadConfig(const char* path, SensorGroup& group) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Failed to open config file: " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int lineno = 0;
+    while (std::getline(in, line)) {
+        lineno++;
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) line.erase(hash);
+
+        std::istringstream fields(line);
+        std::string key, value;
+        if (!(fields >> key)) continue;
+        fields >> value;
+
+        std::string device;
+        bool ok = false;
+        if (key == "device") {
+            uint8_t addr;
+            ok = parseDeviceSpec(value, device, addr);
+            if (ok && group.hasDevice(device, addr)) {
+                std::cerr << path << ":" << lineno << ": device '" << value << "' is already listed" << std::endl;
+                return false;
+            }
+            if (ok) group.addDevice(device, addr);
+        } else if (key == "cpu") {
+            int cpu;
+            ok = parseCpuSpec(value, device, cpu);
+            if (ok) group.setBusCpu(device, cpu);
+        } else if (key == "irq") {
+            uint8_t addr;
+            std::string chip;
+            unsigned int offset;
+            ok = parseIrqSpec(value, device, addr, chip, offset);
+            if (ok) group.setIrqLine(device, addr, chip, offset);
+        }
+        if (!ok) {
+            std::cerr << path << ":" << lineno << ": invalid entry '" << line << "'" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+#define DEFAULT_KEYFRAME_MS 1000
+
+// Per-datapoint send policy. A value is sent the first time, when any channel
+// has moved by more than the deadband since the last value sent, or once
+// keyframe_us has passed so consumers can always rebuild the current state.
+// A deadband of 0 sends on any change; a negative one sends every value.
+class ChangeFilter {
+private:
+    std::vector<uint16_t> last;
+    int deadband;
+    uint64_t keyframe_us;           // 0 disables keyframes
+    uint64_t last_sent;
+    bool primed;
+    uint64_t suppressed;
+
+public:
+    ChangeFilter(size_t channels = 1, int deadband = -1, uint64_t keyframe_us = 0)
+        : last(channels, 0), deadband(deadband), keyframe_us(keyframe_us),
+          last_sent(0), primed(false), suppressed(0) {}
+
+    // Decide for one value stamped timestamp_us (microseconds); a value that
+    // is sent becomes the new reference
+    bool shouldSend(const uint16_t* vals, uint64_t timestamp_us) {
+        // If the timestamps step backwards, restart the keyframe interval
+        // from here rather than let the unsigned difference wrap
+        if (timestamp_us < last_sent) {
+            last_sent = timestamp_us;
+        }
+        bool send = !primed || deadband < 0 ||
+                    (keyframe_us > 0 && timestamp_us - last_sent >= keyframe_us);
+        for (size_t i = 0; !send && i < last.size(); ++i) {
+            send = std::abs((int)vals[i] - (int)last[i]) > deadband;
+        }
+        if (!send) {
+            suppressed++;
+            return false;
+        }
+        std::copy(vals, vals + last.size(), last.begin());
+        last_sent = timestamp_us;
+        primed = true;
+        return true;
+    }
+
+    uint64_t suppressedCount() const {
+        return suppressed;
+    }
+};
+
+#define HOST_TOUCH_ELECTRODES 12
+#define HOST_TOUCH_LANES 16             // row stride: electrodes padded to a vector multiple
+#define HOST_TOUCH_BASELINE_SHIFT 8     // baseline follows idle data over ~256 samples
+#define DEFAULT_TOUCH_DEBOUNCE 2
+
+// Touch detection on the host from the filtered electrode data, next to the
+// chip's own. State is kept as a struct of arrays, one row of
+// HOST_TOUCH_LANES per sensor, so the per-sample kernel is a handful of
+// branch-free loops over contiguous int32 lanes that the compiler turns into
+// SIMD. The baseline is Q8 fixed point and only tracks while an electrode is
+// released; touch and release thresholds give hysteresis, and a new state
+// must hold for 'debounce' consecutive samples.
+class HostTouchDetector {
+private:
+    size_t nsensors;
+    int32_t debounce;
+    std::vector<int32_t> baseline;      // Q8 counts
+    std::vector<int32_t> touch_thresh;
+    std::vector<int32_t> release_thresh;
+    std::vector<int32_t> state;         // 0 released, 1 touched
+    std::vector<int32_t> pending;       // consecutive samples disagreeing with state
+    std::vector<bool> primed;
+
+    // One sensor's row. Selects are written as masks (s - 1 is all ones
+    // while released) so the loop has no control flow to stop it vectorizing.
+    static void step(const int32_t* __restrict x, int32_t* __restrict base,
+                     int32_t* __restrict st, int32_t* __restrict pend,
+                     const int32_t* __restrict touch, const int32_t* __restrict release,
+                     int32_t hold) {
+        for (int i = 0; i < HOST_TOUCH_LANES; ++i) {
+            int32_t s = st[i];
+            // A touch pulls the filtered value below the baseline
+            int32_t delta = (base[i] >> 8) - x[i];
+            int32_t thresh = release[i] + ((touch[i] - release[i]) & (s - 1));
+            int32_t raw = delta > thresh;
+            int32_t differs = raw ^ s;
+            int32_t count = (pend[i] + 1) & -differs;
+            int32_t flip = count >= hold;
+            s ^= flip;
+            pend[i] = count & (flip - 1);
+            int32_t idle = -((s | raw) == 0);
+            base[i] += (((x[i] << 8) - base[i]) >> HOST_TOUCH_BASELINE_SHIFT) & idle;
+            st[i] = s;
+        }
+    }
+
+public:
+    HostTouchDetector(size_t sensors, int touch, int release, int debounce)
+        : nsensors(sensors), debounce(debounce),
+          baseline(sensors * HOST_TOUCH_LANES, 0),
+          touch_thresh(sensors * HOST_TOUCH_LANES, touch),
+          release_thresh(sensors * HOST_TOUCH_LANES, release),
+          state(sensors * HOST_TOUCH_LANES, 0),
+          pending(sensors * HOST_TOUCH_LANES, 0),
+          primed(sensors, false) {}
+
+    bool setThresholds(size_t sensor, int electrode, int touch, int release) {
+        if (sensor >= nsensors || electrode < 0 || electrode >= HOST_TOUCH_ELECTRODES) {
+            return false;
+        }
+        touch_thresh[sensor * HOST_TOUCH_LANES + electrode] = touch;
+        release_thresh[sensor * HOST_TOUCH_LANES + electrode] = release;
+        return true;
+    }
+
+    // Feed one sample's filtered data; returns the touched bitmask
+    uint16_t update(size_t sensor, const MPR121Sample& data) {
+        size_t row = sensor * HOST_TOUCH_LANES;
+        int32_t x[HOST_TOUCH_LANES] = { 0 };
+        for (int i = 0; i < HOST_TOUCH_ELECTRODES; ++i) {
+            x[i] = data.filtered[i];
+        }
+        if (!primed[sensor]) {
+            for (int i = 0; i < HOST_TOUCH_LANES; ++i) {
+                baseline[row + i] = x[i] << 8;
+            }
+            primed[sensor] = true;
+        }
+
+        step(x, &baseline[row], &state[row], &pending[row],
+             &touch_thresh[row], &release_thresh[row], debounce);
+
+        uint16_t mask = 0;
+        for (int i = 0; i < HOST_TOUCH_ELECTRODES; ++i) {
+            mask |= state[row + i] << i;
+        }
+        return mask;
+    }
+};
+
+// Parse a host touch threshold: "<touch>:<release>" for every electrode, or
+// "<sensor>:<electrode>:<touch>:<release>" for one (sensor/electrode -1)
+bool parseThresholdSpec(const std::string& spec, int& sensor, int& electrode,
+                        int& touch, int& release) {
+    std::vector<long> fields;
+    const char* p = spec.c_str();
+    for (;;) {
+        char* end;
+        long v = strtol(p, &end, 10);
+        if (end == p || v < 0 || v > 1023) return false;
+        fields.push_back(v);
+        if (*end == '\0') break;
+        if (*end != ':') return false;
+        p = end + 1;
+    }
+    if (fields.size() != 2 && fields.size() != 4) return false;
+
+    sensor = fields.size() == 4 ? fields[0] : -1;
+    electrode = fields.size() == 4 ? fields[1] : -1;
+    touch = fields[fields.size() - 2];
+    release = fields[fields.size() - 1];
+    return release <= touch && (electrode < HOST_TOUCH_ELECTRODES);
+}
+
+#define DECIMATE_LANES 16               // row stride: channels padded to a vector multiple
+#define DECIMATE_MAX_TAPS 1023
+
+enum DecimateFilter {
+    DECIMATE_MEAN,                      // boxcar average over each window
+    DECIMATE_MINMAX,                    // average, plus the window's minimum and maximum
+    DECIMATE_FIR                        // FIR low-pass evaluated once per window
+};
+
+// Reduces the per-tick filtered data of every channel to one frame per
+// 'factor' ticks. Windows are aligned on sample sequence numbers, so every
+// sensor's frames cover the same ticks; a window cut short by missed ticks
+// averages what it has, and if its last tick is missed too, the first
+// sample of a later window finishes it (finishStale). Like HostTouchDetector, state is a struct of arrays
+// with one row of DECIMATE_LANES per sensor, and each kernel is a plain loop
+// over a row that the compiler vectorizes. The FIR keeps a history ring of
+// one row per tap and only evaluates at window ends. Samples across a short
+// gap of skipped ticks enter the history as if they were contiguous; after a
+// gap as long as the filter, none of the history is in its span any more, so
+// it is cleared and refilled before the next frame.
+class Decimator {
+private:
+    uint64_t factor;
+    DecimateFilter filter;
+    std::vector<float> taps;            // unit DC gain, taps[0] applies to the newest row
+    size_t ntaps;
+
+    std::vector<int32_t> sum;
+    std::vector<uint16_t> low, high;
+    std::vector<uint32_t> count;
+    std::vector<uint64_t> window;
+    std::vector<uint64_t> first_ts, last_ts;
+
+    std::vector<float> history;         // ntaps rows per sensor
+    std::vector<uint64_t> history_ts;
+    std::vector<size_t> head;           // next history row to write
+    std::vector<size_t> filled;         // history rows written, up to ntaps
+    std::vector<uint64_t> last_seq;     // tick of the newest history row
+
+    std::vector<uint16_t> out, out_low, out_high;
+    std::vector<uint64_t> out_ts;
+
+    static void accumulate(const uint16_t* __restrict x, int32_t* __restrict total,
+                           uint16_t* __restrict lo, uint16_t* __restrict hi) {
+        for (int i = 0; i < DECIMATE_LANES; ++i) {
+            total[i] += x[i];
+            lo[i] = x[i] < lo[i] ? x[i] : lo[i];
+            hi[i] = x[i] > hi[i] ? x[i] : hi[i];
+        }
+    }
+
+    static void multiplyAdd(const float* __restrict row, float tap, float* __restrict acc) {
+        for (int i = 0; i < DECIMATE_LANES; ++i) {
+            acc[i] += tap * row[i];
+        }
+    }
+
+    void finishMean(size_t sensor) {
+        size_t row = sensor * DECIMATE_LANES;
+        int32_t n = count[sensor];
+        for (int i = 0; i < DECIMATE_LANES; ++i) {
+            out[row + i] = (sum[row + i] + n / 2) / n;
+        }
+        std::copy(&low[row], &low[row] + DECIMATE_LANES, &out_low[row]);
+        std::copy(&high[row], &high[row] + DECIMATE_LANES, &out_high[row]);
+        out_ts[sensor] = first_ts[sensor] + (last_ts[sensor] - first_ts[sensor]) / 2;
+        count[sensor] = 0;
+    }
+
+    // Stamped with the tick at the filter's group delay
+    void finishFir(size_t sensor) {
+        size_t base = sensor * ntaps;
+        float acc[DECIMATE_LANES] = { 0 };
+        for (size_t k = 0; k < ntaps; ++k) {
+            size_t r = (head[sensor] + ntaps - 1 - k) % ntaps;
+            multiplyAdd(&history[(base + r) * DECIMATE_LANES], taps[k], acc);
+        }
+        size_t row = sensor * DECIMATE_LANES;
+        for (int i = 0; i < DECIMATE_LANES; ++i) {
+            float v = acc[i] + 0.5f;
+            out[row + i] = v < 0 ? 0 : (v > 65535 ? 65535 : (uint16_t)v);
+        }
+        out_ts[sensor] = history_ts[base + (head[sensor] + ntaps - 1 - (ntaps - 1) / 2) % ntaps];
+        count[sensor] = 0;
+    }
+
+public:
+    // taps are scaled to unit gain; with no taps, FIR uses a Hamming
+    // windowed-sinc low-pass cutting off at the output Nyquist rate
+    Decimator(size_t sensors, int factor, DecimateFilter filter, std::vector<float> fir_taps)
+        : factor(factor), filter(filter), taps(fir_taps),
+          sum(sensors * DECIMATE_LANES, 0), low(sensors * DECIMATE_LANES, 0),
+          high(sensors * DECIMATE_LANES, 0), count(sensors, 0), window(sensors, 0),
+          first_ts(sensors, 0), last_ts(sensors, 0), head(sensors, 0), filled(sensors, 0),
+          last_seq(sensors, 0),
+          out(sensors * DECIMATE_LANES, 0), out_low(sensors * DECIMATE_LANES, 0),
+          out_high(sensors * DECIMATE_LANES, 0), out_ts(sensors, 0) {
+        if (filter == DECIMATE_FIR && taps.empty()) {
+            int n = std::min(4 * factor + 1, DECIMATE_MAX_TAPS);
+            double cutoff = 0.5 / factor;
+            for (int k = 0; k < n; ++k) {
+                double t = k - (n - 1) / 2.0;
+                double sinc = t == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * t) / (M_PI * t);
+                taps.push_back(sinc * (0.54 - 0.46 * cos(2 * M_PI * k / (n - 1))));
+            }
+        }
+        double gain = 0;
+        for (float tap : taps) gain += tap;
+        for (float& tap : taps) tap /= gain;
+        ntaps = filter == DECIMATE_FIR ? taps.size() : 0;
+        history.assign(sensors * ntaps * DECIMATE_LANES, 0.0f);
+        history_ts.assign(sensors * ntaps, 0);
+    }
+
+    size_t tapCount() const { return ntaps; }
+
+    // Feed one tick's sample; true when it completes a frame
+    bool update(size_t sensor, const MPR121Sample& data, uint64_t seq, uint64_t timestamp) {
+        uint16_t x[DECIMATE_LANES] = { 0 };
+        for (int i = 0; i < MPR121_NCHANNELS; ++i) {
+            x[i] = data.filtered[i];
+        }
+
+        if (filter == DECIMATE_FIR) {
+            if (filled[sensor] > 0 && seq - last_seq[sensor] >= ntaps) {
+                filled[sensor] = 0;
+                count[sensor] = 0;
+            }
+            last_seq[sensor] = seq;
+            float* row = &history[(sensor * ntaps + head[sensor]) * DECIMATE_LANES];
+            for (int i = 0; i < DECIMATE_LANES; ++i) {
+                row[i] = x[i];
+            }
+            history_ts[sensor * ntaps + head[sensor]] = timestamp;
+            head[sensor] = (head[sensor] + 1) % ntaps;
+            // No frames until the history is full, so the first is not a
+            // filter ringing up from zero
+            if (filled[sensor] < ntaps) {
+                filled[sensor]++;
+                if (filled[sensor] < ntaps) return false;
+            }
+            window[sensor] = seq / factor;
+            count[sensor]++;
+        } else {
+            size_t row = sensor * DECIMATE_LANES;
+            if (count[sensor] == 0 || seq / factor != window[sensor]) {
+                std::fill(&sum[row], &sum[row] + DECIMATE_LANES, 0);
+                std::fill(&low[row], &low[row] + DECIMATE_LANES, 0xFFFF);
+                std::fill(&high[row], &high[row] + DECIMATE_LANES, 0);
+                count[sensor] = 0;
+                window[sensor] = seq / factor;
+                first_ts[sensor] = timestamp;
+            }
+            accumulate(x, &sum[row], &low[row], &high[row]);
+            count[sensor]++;
+            last_ts[sensor] = timestamp;
+        }
+
+        if (seq % factor != factor - 1) {
+            return false;
+        }
+        if (filter == DECIMATE_FIR) {
+            finishFir(sensor);
+        } else {
+            finishMean(sensor);
+        }
+        return true;
+    }
+
+    // Finish a window whose last tick was never sampled, before the sample
+    // at seq starts a later one. Returns whether a frame was completed.
+    bool finishStale(size_t sensor, uint64_t seq) {
+        if (count[sensor] == 0 || seq / factor == window[sensor]) {
+            return false;
+        }
+        if (filter == DECIMATE_FIR) {
+            finishFir(sensor);
+        } else {
+            finishMean(sensor);
+        }
+        return true;
+    }
+
+    // The last completed frame, indexed by channel
+    const uint16_t* frame(size_t sensor) const { return &out[sensor * DECIMATE_LANES]; }
+    const uint16_t* frameMin(size_t sensor) const { return &out_low[sensor * DECIMATE_LANES]; }
+    const uint16_t* frameMax(size_t sensor) const { return &out_high[sensor * DECIMATE_LANES]; }
+    uint64_t frameTimestamp(size_t sensor) const { return out_ts[sensor]; }
+};
+
+// Parse a comma-separated FIR tap list such as "1,2,1"
+bool parseTapList(const std::string& spec, std::vector<float>& taps) {
+    taps.clear();
+    const char* p = spec.c_str();
+    double gain = 0;
+    for (;;) {
+        char* end;
+        double v = strtod(p, &end);
+        if (end == p || !std::isfinite(v)) return false;
+        taps.push_back(v);
+        gain += v;
+        if (*end == '\0') break;
+        if (*end != ',') return false;
+        p = end + 1;
+    }
+    return taps.size() <= DECIMATE_MAX_TAPS && gain != 0;
+}
+
+#define CHANNEL_LANES 16                // row stride: channels padded to a vector multiple
+
+// The channels one sensor publishes, as a mask (bit n for electrode n, bit
+// 12 for the proximity channel), and the routine that unpacks them. A
+// datapoint carries the selected channels in channel order.
+class ChannelMap {
+private:
+    uint16_t bits;
+    std::vector<uint8_t> index;         // channel number of each datapoint slot
+
+    // Whole rows, no control flow: baselines to 10-bit counts, then
+    // baseline - filtered
+    static void expand(const uint16_t* __restrict filtered, const uint8_t* __restrict raw,
+                       uint16_t* __restrict base, int32_t* __restrict delta) {
+        for (int i = 0; i < CHANNEL_LANES; ++i) {
+            base[i] = raw[i] << 2;
+            delta[i] = (int32_t)base[i] - filtered[i];
+        }
+    }
+
+public:
+    ChannelMap(uint16_t mask = DEFAULT_CHANNEL_MASK) : bits(mask) {
+        for (int i = 0; i < MPR121_NCHANNELS; ++i) {
+            if (mask & (1 << i)) index.push_back(i);
+        }
+    }
+
+    uint16_t mask() const { return bits; }
+    size_t count() const { return index.size(); }
+
+    // Unpack one sample's selected channels: filtered counts, or the
+    // matching slots of a decimated frame when frame is given, baselines and
+    // deltas. Any output may be null.
+    void unpack(const MPR121Sample& s, const uint16_t* frame,
+                uint16_t* vals, uint16_t* baseline, int32_t* delta) const {
+        uint16_t row[CHANNEL_LANES] = { 0 };
+        uint8_t raw[CHANNEL_LANES] = { 0 };
+        if (frame) {
+            memcpy(row, frame, MPR121_NCHANNELS * sizeof(uint16_t));
+        } else {
+            memcpy(row, s.filtered, sizeof(s.filtered));
+        }
+        memcpy(raw, s.baseline, sizeof(s.baseline));
+
+        uint16_t base[CHANNEL_LANES];
+        int32_t diff[CHANNEL_LANES];
+        expand(row, raw, base, diff);
+        for (size_t k = 0; k < index.size(); ++k) {
+            if (vals) vals[k] = row[index[k]];
+            if (baseline) baseline[k] = base[index[k]];
+            if (delta) delta[k] = diff[index[k]];
+        }
+    }
+
+    // The selected slots of a per-channel row such as a min/max frame
+    void gather(const uint16_t* row, uint16_t* out) const {
+        for (size_t k = 0; k < index.size(); ++k) {
+            out[k] = row[index[k]];
+        }
+    }
+};
+
+// Parse a channel mask "<mask>" for every sensor or "<sensor>:<mask>" for
+// one (sensor -1); masks are numbers such as 0x0FFF or 4095
+bool parseChannelSpec(const std::string& spec, int& sensor, uint16_t& mask) {
+    size_t colon = spec.find(':');
+    sensor = -1;
+    const char* p = spec.c_str();
+    char* end;
+    if (colon != std::string::npos) {
+        long id = strtol(p, &end, 10);
+        if (end != p + colon || id < 0) return false;
+        sensor = id;
+        p += colon + 1;
+    }
+    long m = strtol(p, &end, 0);
+    if (end == p || *end != '\0' || m < 1 || m >= (1 << MPR121_NCHANNELS)) return false;
+    mask = m;
+    return true;
+}
+
+// Global variables
+std::atomic<bool> running(true);
+std::atomic<bool> stats_requested(false);
+
+// Add this debug function in the main loop, right after the filtered data reads:
+void printDebugOutput(MPR121& sensor, int sensor_num, const uint16_t* filtered_data, size_t count)
+{
+  auto now = std::chrono::system_clock::now();
+  auto t = std::chrono::system_clock::to_time_t(now);
+  
+  std::cout << "Sensor[" << sensor_num << "] " 
 	    << std::put_time(std::localtime(&t), "%H:%M:%S") << " | ";
   
-  for (int i = 0; i < NSENSORS; ++i) {
+  for (size_t i = 0; i < count; ++i) {
     uint16_t value = filtered_data[i];
     std::cout << std::setw(4) << value << " ";
   }
   std::cout << " | touched: 0x" << std::hex << sensor.touched() << std::dec << std::endl;
 }
 
-void dumpMPR121(int file) {
-    auto readBlock = [&](uint8_t start, size_t len, uint8_t *buf) -> bool {
-        if (write(file, &start, 1) != 1) return false;
-        return read(file, buf, len) == (ssize_t)len;
+void dumpMPR121(MPR121& sensor) {
+    // One burst read of everything from touch status through ECR
+    uint8_t regs[MPR121_ECR + 1];
+    if (!sensor.readRegisters(MPR121_TOUCHSTATUS_L, regs, sizeof(regs))) {
+        std::cout << "Failed to read registers\n\n";
+        return;
+    }
+    auto word = [&](int reg) { return (uint16_t)(regs[reg] | (regs[reg + 1] << 8)); };
+
+    // Touch Status
+    uint16_t status = word(MPR121_TOUCHSTATUS_L);
+    std::cout << "Touch Status (0x00–0x01): 0x" << std::hex << status << std::dec << "\n";
+    for (int i = 0; i < 12; ++i)
+        std::cout << "  Electrode " << i << ": " << ((status & (1 << i)) ? "Touched" : "Released") << "\n";
+
+    // Filtered Electrode Data
+    std::cout << "\nFiltered Electrode Data (0x04–0x1B):\n";
+    for (int i = 0; i < 12; ++i) {
+        std::cout << "  E" << i << ": " << word(MPR121_FILTDATA_0L + i * 2) << "\n";
+    }
+
+    // Baseline Filter
+    std::cout << "\nBaseline Filter (0x2B–0x32):\n";
+    std::cout << "  Rising:  MHD=" << (int)regs[MPR121_MHDR] << " NHD=" << (int)regs[MPR121_NHDR]
+              << " NCL=" << (int)regs[MPR121_NCLR] << " FDL=" << (int)regs[MPR121_FDLR] << "\n";
+    std::cout << "  Falling: MHD=" << (int)regs[MPR121_MHDF] << " NHD=" << (int)regs[MPR121_NHDF]
+              << " NCL=" << (int)regs[MPR121_NCLF] << " FDL=" << (int)regs[MPR121_FDLF] << "\n";
+
+    // Thresholds
+    std::cout << "\nTouch/Release Thresholds (0x41–0x58):\n";
+    for (int i = 0; i < 12; ++i) {
+        std::cout << "  E" << i << ": Touch=" << (int)regs[MPR121_TOUCHTH_0 + i * 2]
+                  << ", Release=" << (int)regs[MPR121_RELEASETH_0 + i * 2] << "\n";
+    }
+
+    // Debounce, AFE configuration and ECR
+    std::cout << "\nDebounce/Config/ECR (0x5B–0x5E):\n";
+    std::cout << "  Debounce (0x5B): " << (int)regs[0x5B] << "\n";
+    std::cout << "  Config 1 (0x5C): 0x" << std::hex << (int)regs[MPR121_CONFIG1] << std::dec
+              << " (FFI, CDC " << (regs[MPR121_CONFIG1] & 0x3F) << " uA)\n";
+    std::cout << "  Config 2 (0x5D): 0x" << std::hex << (int)regs[MPR121_CONFIG2] << std::dec
+              << " (CDT, SFI, ESI)\n";
+    std::cout << "  ECR (0x5E): 0x" << std::hex << (int)regs[MPR121_ECR] << std::dec << " → "
+              << (regs[MPR121_ECR] & 0x0F) << " electrodes enabled\n";
+
+    std::cout << "\n";
+}
+
+void printUsage(const char* program_name) {
+    std::cout << "Usage: " << program_name << " [OPTIONS]\n"
+              << "Options:\n"
+              << "  -h, --host <address>    Dataserver host address (default: " << DEFAULT_DATASERVER_ADDRESS << ")\n"
+              << "  -p, --port <port>       Dataserver port (default: " << DSERV_PORT << ")\n"
+              << "  -t, --timer <ms>        Timer interval in milliseconds (default: " << DEFAULT_TIMER_INTERVAL_MS << ")\n"
+              << "  -d, --device <bus:addr> Add an MPR121, e.g. 1:0x5A (repeatable; default: 1:0x5A 1:0x5B)\n"
+              << "  --cpu <bus:core>        Pin the sampling thread for a bus to a CPU core\n"
+              << "  --irq <bus:addr@chip:line> Send touch changes as soon as the MPR121 raises IRQ on this\n"
+              << "                          GPIO line, e.g. 1:0x5A@0:17 (repeatable; simulated with --sim)\n"
+              << "  --config <file>         Read 'device <bus:addr>', 'cpu <bus:core>' and\n"
+              << "                          'irq <bus:addr@chip:line>' lines from a file\n"
+              << "  --overflow <policy>     Sample queue overflow policy: drop-oldest or drop-newest (default: drop-oldest)\n"
+              << "  --mirror <host[:port]>  Also send every datapoint to this host; repeatable. Append\n"
+              << "                          ,drop-newest to keep its queued data when it falls behind\n"
+              << "                          (default: ,drop-oldest)\n"
+              << "  --udp <host[:port]>     Send vals as UDP datagrams (unicast or multicast) instead of\n"
+              << "                          over TCP; touch changes stay on TCP (default port: " << DSERV_PORT << ")\n"
+              << "  --udp-ttl <n>           Multicast TTL for --udp (default: 1)\n"
+              << "  --host-touch            Also detect touches on the host and publish grasp/sensorN/hosttouched\n"
+              << "  --touch-threshold <t:r> Host touch/release thresholds in counts (default: "
+              << DEFAULT_TOUCH_THRESHOLD << ":" << DEFAULT_RELEASE_THRESHOLD << "), or\n"
+              << "                          <sensor:electrode:t:r> for one electrode; repeatable\n"
+              << "  --debounce <n>          Samples a host touch state must hold (default: " << DEFAULT_TOUCH_DEBOUNCE << ")\n"
+              << "  --deadband <counts>     Send vals only when a channel moves by more than <counts>\n"
+              << "  --keyframe <ms>         Resend unchanged values this often (default: " << DEFAULT_KEYFRAME_MS << " with --deadband, else never)\n"
+              << "  --channels <mask>       Channels vals carry: bit n for electrode n, bit 12 for proximity\n"
+              << "                          (default: 0x003F, E0-E5), or <sensor:mask> for one sensor\n"
+              << "  --baseline              Also send each channel's baseline as grasp/sensorN/baseline\n"
+              << "  --delta                 Also send baseline - filtered as grasp/sensorN/delta\n"
+              << "  --decimate <n>          Forward one filtered vals frame per n ticks; touch changes still\n"
+              << "                          go out every tick\n"
+              << "  --decimate-filter <f>   Frame filter: mean, minmax (mean plus vals_min/vals_max) or fir\n"
+              << "                          (default: mean)\n"
+              << "  --fir-taps <c0,c1,...>  FIR coefficients, newest sample first, implies --decimate-filter fir\n"
+              << "                          (default: windowed-sinc low-pass)\n"
+              << "  --idle-interval <ms>    Sample at this interval while nothing is touched, and at the\n"
+              << "                          -t interval from the first touch (multiple of -t; default: off)\n"
+              << "  --burst-hold <ms>       Keep the -t rate this long after the last touch (default: "
+              << DEFAULT_BURST_HOLD_MS << ")\n"
+              << "  --wake-delta <counts>   Also burst when a channel is this far below baseline (default: "
+              << DEFAULT_WAKE_DELTA << ")\n"
+              << "  --coalesce <us>         Batch datapoints into one send, holding them at most <us> microseconds\n"
+              << "                          (0 sends once per tick; default: one send per datapoint)\n"
+              << "  --realtime              Run sampling threads under SCHED_FIFO with locked, pre-faulted memory\n"
+              << "  --rt-priority <1-99>    SCHED_FIFO priority, implies --realtime (default: " << RT_DEFAULT_PRIORITY << ")\n"
+              << "  --stats-interval <s>    Report pipeline latency statistics every <s> seconds (also on SIGUSR1)\n"
+              << "  --publish-stats         Also publish statistics reports as grasp/stats/* datapoints\n"
+              << "  --sim                   Use simulated MPR121s instead of /dev/i2c-N (no hardware needed)\n"
+              << "  --sim-bus-hz <hz>       Simulated I2C clock for transfer timing, 0 = instant (default: 100000)\n"
+              << "  --sim-latency <us>      Extra simulated latency per I2C transaction (default: 0)\n"
+              << "  --sim-nak <percent>     Percentage of simulated I2C transactions that NAK (default: 0)\n"
+              << "  --clock <source>        Timestamp clock: realtime (monotonic, mapped to wall time) or tai\n"
+              << "                          (default: realtime)\n"
+              << "  --bus-windows           Also publish each sensor's I2C transaction window\n"
+              << "  --spool <n>             Keep up to n datapoints during outages and replay them\n"
+              << "  --spool-file <path>     Keep the spool in a file that survives restarts (implies --spool " << DEFAULT_SPOOL_CAPACITY << ")\n"
+              << "  --spool-rate <n>        Replay spooled datapoints at n per second (default: " << DEFAULT_SPOOL_RATE << ")\n"
+              << "  --peer-timeout <ms>     Drop the dataserver connection if it stalls this long (default: " << PEER_TIMEOUT_MS << ")\n"
+              << "  --compact               Send variable-length datapoints instead of fixed 128-byte messages\n"
+              << "                          (requires a dataserver that supports compact framing)\n"
+              << "  --bench-pack [n]        Time packing n datapoints (default: 10000000) and exit\n"
+              << "  --self-check <name>     Run an internal check (ring, spool, filter or decimate) and exit\n"
+              << "  --help                  Show this help message\n"
+              << "\nExample:\n"
+              << "  " << program_name << " -h 192.168.1.100 -p 4620 -t 50\n"
+              << "  " << program_name << " --host server.local --timer 10  # 100Hz sampling\n"
+              << "  " << program_name << " -d 1:0x5A -d 1:0x5B -d 3:0x5A -d 3:0x5B --cpu 3:2\n"
+              << std::endl;
+}
+
+void signalHandler(int signal) {
+    std::cout << "\nReceived signal " << signal << ", shutting down..." << std::endl;
+    running.store(false);
+}
+
+void statsSignalHandler(int) {
+    stats_requested.store(true);
+}
+
+// Print every pipeline histogram and counter
+void printStats(std::ostream& out, const SensorGroup& group, const DataserverClient& client,
+                const Histogram& end_to_end) {
+    out << "Pipeline latency since start:" << std::endl;
+    for (size_t n = 0; n < group.busCount(); ++n) {
+        group.wakeupLatency(n).print(out, group.busDevice(n) + " wakeup");
+    }
+    for (size_t id = 0; id < group.size(); ++id) {
+        group.i2cTime(id).print(out, "sensor" + std::to_string(id) + " i2c");
+    }
+    client.pack_time.print(out, "pack");
+    client.destination(0).send_time.print(out, "send");
+    for (size_t n = 1; n < client.destinationCount(); ++n) {
+        client.destination(n).send_time.print(out, "send " + client.destination(n).name());
+    }
+    end_to_end.print(out, "end-to-end");
+    out << "Overruns: " << group.overrunCount()
+        << ", skipped ticks: " << group.skippedTicks()
+        << ", dropped samples: " << group.droppedSamples()
+        << ", send queue overflows: " << client.overflowCount() << std::endl;
+    if (group.hasIrqLines()) {
+        out << "IRQ: " << group.irqReads() << " touch status reads" << std::endl;
+    }
+    if (group.isAdaptive()) {
+        out << "Adaptive rate: " << group.burstCount() << " bursts, "
+            << group.sampledTicks() << " ticks sampled" << std::endl;
+    }
+    if (group.dropoutCount() > 0) {
+        out << "Devices: " << group.dropoutCount() << " dropouts, " << group.recoveryCount()
+            << " recoveries, " << group.downCount() << " quarantined now" << std::endl;
+    }
+    for (size_t n = 1; n < client.destinationCount(); ++n) {
+        const DataserverConnection& mirror = client.destination(n);
+        out << "Mirror " << mirror.name() << ": " << (mirror.isConnected() ? "connected" : "disconnected")
+            << ", send queue overflows: " << mirror.overflowCount() << std::endl;
+    }
+    if (client.hasDatagramDestination()) {
+        out << "UDP: sent " << client.datagramsSent()
+            << ", dropped " << client.datagramsDropped() << std::endl;
+    }
+    if (client.isSpooling()) {
+        out << "Spool: spooled " << client.spooledCount()
+            << ", replayed " << client.replayedCount()
+            << ", dropped " << client.spoolDroppedCount() << std::endl;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double cpu_us = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6 +
+                    usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    uint64_t ticks = group.sampledTicks();
+    out << "CPU: " << std::fixed << std::setprecision(1) << cpu_us / 1000.0 << "ms over "
+        << ticks << " ticks (" << (ticks ? cpu_us / ticks : 0.0) << "us/tick)" << std::endl;
+    out.unsetf(std::ios::fixed);
+}
+
+// Publish the same snapshot as grasp/stats/* datapoints (sender thread only)
+void publishStats(const SensorGroup& group, DataserverClient& client, const Histogram& end_to_end) {
+    int32_t summary[6];
+    for (size_t n = 0; n < group.busCount(); ++n) {
+        group.wakeupLatency(n).pack(summary);
+        std::string point = "grasp/stats/bus" + std::to_string(n) + "/wakeup";
+        client.writeToDataserver(point.c_str(), DSERV_INT, sizeof(summary), summary);
+    }
+    for (size_t id = 0; id < group.size(); ++id) {
+        group.i2cTime(id).pack(summary);
+        std::string point = "grasp/stats/sensor" + std::to_string(id) + "/i2c";
+        client.writeToDataserver(point.c_str(), DSERV_INT, sizeof(summary), summary);
+    }
+    client.pack_time.pack(summary);
+    client.writeToDataserver("grasp/stats/pack", DSERV_INT, sizeof(summary), summary);
+    client.destination(0).send_time.pack(summary);
+    client.writeToDataserver("grasp/stats/send", DSERV_INT, sizeof(summary), summary);
+    end_to_end.pack(summary);
+    client.writeToDataserver("grasp/stats/e2e", DSERV_INT, sizeof(summary), summary);
+
+    int32_t counters[4] = {
+        (int32_t)group.overrunCount(),
+        (int32_t)group.skippedTicks(),
+        (int32_t)group.droppedSamples(),
+        (int32_t)client.overflowCount()
     };
+    client.writeToDataserver("grasp/stats/counters", DSERV_INT, sizeof(counters), counters);
 
-    uint8_t buf[64];
+    if (client.hasDatagramDestination()) {
+        int32_t udp_counters[2] = {
+            (int32_t)client.datagramsSent(),
+            (int32_t)client.datagramsDropped()
+        };
+        client.writeToDataserver("grasp/stats/udp", DSERV_INT, sizeof(udp_counters), udp_counters);
+    }
 
-    // Touch Status
-    if (readBlock(0x00, 2, buf)) {
-        uint16_t status = buf[0] | (buf[1] << 8);
-        std::cout << "Touch Status (0x00–0x01): 0x" << std::hex << status << std::dec << "\n";
-        for (int i = 0; i < 12; ++i)
-            std::cout << "  Electrode " << i << ": " << ((status & (1 << i)) ? "Touched" : "Released") << "\n";
+    if (client.isSpooling()) {
+        int32_t spool_counters[3] = {
+            (int32_t)client.spooledCount(),
+            (int32_t)client.replayedCount(),
+            (int32_t)client.spoolDroppedCount()
+        };
+        client.writeToDataserver("grasp/stats/spool", DSERV_INT, sizeof(spool_counters), spool_counters);
     }
+}
 
-    // Raw Electrode Data
-    if (readBlock(0x04, 24, buf)) {
-        std::cout << "\nRaw Electrode Data (0x04–0x1B):\n";
-        for (int i = 0; i < 12; ++i) {
-            uint16_t val = buf[i * 2] | (buf[i * 2 + 1] << 8);
-            std::cout << "  E" << i << ": " << val << "\n";
+// Packer microbenchmark (--bench-pack): ns per vals message packed from its
+// registered descriptor, against describing the datapoint on every call as
+// one-off datapoints are
+int benchmarkPacking(long count) {
+    const char* name = "grasp/sensor0/vals";
+    uint16_t payload[6] = { 600, 610, 620, 630, 640, 650 };
+    Datapoint vals(name, DSERV_SHORT, sizeof(payload));
+    std::vector<char> block(PACK_BLOCK_SIZE);
+    size_t slots = PACK_BLOCK_SIZE / DPOINT_BINARY_FIXED_LENGTH;
+
+    auto run = [&](bool describe, size_t msg_len) {
+        auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < count; ++i) {
+            char* buf = &block[(i % slots) * DPOINT_BINARY_FIXED_LENGTH];
+            payload[0] = i;
+            if (describe) {
+                Datapoint(name, DSERV_SHORT, sizeof(payload)).pack(buf, msg_len, payload, i + 1);
+            } else {
+                vals.pack(buf, msg_len, payload, i + 1);
+            }
+        }
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        return (double)ns / count;
+    };
+
+    std::cout << "Packing " << count << " " << name << " messages:" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "  descriptor, fixed:    " << run(false, DPOINT_BINARY_FIXED_LENGTH) << " ns/msg" << std::endl;
+    std::cout << "  descriptor, compact:  " << run(false, vals.packedLength()) << " ns/msg" << std::endl;
+    std::cout << "  per call, fixed:      " << run(true, DPOINT_BINARY_FIXED_LENGTH) << " ns/msg" << std::endl;
+    std::cout << "  per call, compact:    " << run(true, vals.packedLength()) << " ns/msg" << std::endl;
+    std::cout.unsetf(std::ios::fixed);
+
+    // Keep the packed bytes live so the loops are not optimized away
+    unsigned checksum = 0;
+    for (char c : block) checksum += (uint8_t)c;
+    return checksum == 0;
+}
+
+// Self-checks (--self-check <name>, make check-*): run one component against
+// known input, with no hardware or dataserver. Each returns its number of
+// failures and reports every one on stderr.
+int expect(bool ok, const char* what) {
+    if (!ok) {
+        std::cerr << "  FAILED: " << what << std::endl;
+    }
+    return ok ? 0 : 1;
+}
+
+int checkRing() {
+    int failures = 0;
+    int item;
+
+    SpscRing<int, 4> oldest(DROP_OLDEST);
+    for (int i = 0; i < 6; ++i) oldest.push(i);
+    bool in_order = true;
+    for (int i = 2; i < 6; ++i) in_order &= oldest.pop(item) && item == i;
+    failures += expect(oldest.droppedCount() == 2, "drop-oldest counts the two items it discarded");
+    failures += expect(in_order && !oldest.pop(item), "drop-oldest keeps the newest items in order");
+
+    SpscRing<int, 4> newest(DROP_NEWEST);
+    bool accepted = true;
+    for (int i = 0; i < 4; ++i) accepted &= newest.push(i);
+    failures += expect(accepted && !newest.push(4) && newest.droppedCount() == 1,
+                       "drop-newest refuses an item once full");
+    in_order = true;
+    for (int i = 0; i < 4; ++i) in_order &= newest.pop(item) && item == i;
+    failures += expect(in_order && !newest.pop(item), "drop-newest keeps the oldest items in order");
+
+    // A consumer one item behind, across many wraps of the indices
+    SpscRing<int, 4> wrap;
+    in_order = true;
+    for (int i = 0; i < 1000; ++i) {
+        wrap.push(i);
+        if (i > 0) in_order &= wrap.pop(item) && item == i - 1;
+    }
+    failures += expect(in_order && wrap.pop(item) && item == 999 && wrap.droppedCount() == 0,
+                       "indices wrap without losing items");
+
+    // A producer outrunning the consumer: every item is either popped, in
+    // order, or counted as dropped, never both and never neither
+    const int total = 200000;
+    SpscRing<int, 8> race(DROP_OLDEST);
+    std::atomic<bool> done(false);
+    std::thread producer([&]() {
+        for (int i = 0; i < total; ++i) race.push(i);
+        done.store(true);
+    });
+    long popped = 0;
+    int last = -1;
+    in_order = true;
+    for (;;) {
+        bool finished = done.load();
+        while (race.pop(item)) {
+            in_order &= item > last;
+            last = item;
+            popped++;
+        }
+        if (finished) break;
+    }
+    producer.join();
+    failures += expect(in_order, "concurrent pops come out in push order");
+    failures += expect(popped + (long)race.droppedCount() == total, "concurrent items are popped or dropped exactly once");
+    return failures;
+}
+
+int checkSpool() {
+    int failures = 0;
+    Datapoint point("grasp/sensor0/vals", DSERV_SHORT, 6 * sizeof(uint16_t));
+    size_t len = point.packedLength();
+    char msgs[6][SPOOL_RECORD_SIZE];
+    for (int i = 0; i < 6; ++i) {
+        uint16_t vals[6] = { (uint16_t)i, 1, 2, 3, 4, 5 };
+        memset(msgs[i], 0, SPOOL_RECORD_SIZE);
+        point.pack(msgs[i], len, vals, i + 1);
+    }
+
+    Spool spool;
+    bool kept = spool.open(4, "");
+    for (int i = 0; i < 4; ++i) kept &= spool.push(msgs[i], len);
+    failures += expect(kept && !spool.push(msgs[4], len) && !spool.push(msgs[5], len) && spool.size() == 4,
+                       "a full spool drops its oldest records");
+    bool replay = true;
+    for (int i = 2; i < 6; ++i) {
+        replay &= Spool::datapointLength(spool.front()) == len && memcmp(spool.front(), msgs[i], len) == 0;
+        spool.pop();
+    }
+    failures += expect(replay && spool.size() == 0, "replay returns the newest records, oldest first");
+
+    // Torn records must not be replayed
+    char rec[SPOOL_RECORD_SIZE];
+    memcpy(rec, msgs[0], SPOOL_RECORD_SIZE);
+    rec[0] = 0;
+    failures += expect(Spool::datapointLength(rec) == 0, "a record without a datapoint header is rejected");
+    memcpy(rec, msgs[0], SPOOL_RECORD_SIZE);
+    uint16_t varlen = 0xFFFF;
+    memcpy(rec + 1, &varlen, sizeof(varlen));
+    failures += expect(Spool::datapointLength(rec) == 0, "a name longer than the record is rejected");
+    memcpy(rec, msgs[0], SPOOL_RECORD_SIZE);
+    memcpy(&varlen, rec + 1, sizeof(varlen));
+    uint32_t datalen = SPOOL_RECORD_SIZE;
+    memcpy(rec + 15 + varlen, &datalen, sizeof(datalen));
+    failures += expect(Spool::datapointLength(rec) == 0, "a payload longer than the record is rejected");
+
+    // A spool file keeps its records across reopening, if the layout matches
+    char path[] = "/tmp/mpr121_spool_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        std::cerr << "  Cannot create " << path << ": " << strerror(errno) << std::endl;
+        return failures + 1;
+    }
+    close(fd);
+    {
+        Spool file;
+        kept = file.open(4, path);
+        for (int i = 0; i < 3; ++i) kept &= file.push(msgs[i], len);
+        file.pop();
+    }
+    {
+        Spool file;
+        kept &= file.open(4, path);
+        failures += expect(kept && file.size() == 2 && memcmp(file.front(), msgs[1], len) == 0,
+                           "a reopened spool file replays what was left in it");
+    }
+    {
+        Spool file;
+        failures += expect(file.open(8, path) && file.size() == 0, "a spool file of another capacity starts empty");
+    }
+    fd = open(path, O_RDWR);
+    uint64_t head = 100;
+    bool written = fd >= 0 && pwrite(fd, &head, sizeof(head), 2 * sizeof(uint64_t)) == sizeof(head);
+    if (fd >= 0) close(fd);
+    {
+        Spool file;
+        failures += expect(written && file.open(8, path) && file.size() == 0,
+                           "a spool file whose header overflows its capacity starts empty");
+    }
+    unlink(path);
+    return failures;
+}
+
+int checkChangeFilter() {
+    int failures = 0;
+    uint16_t v;
+    auto send = [&](ChangeFilter& filter, uint16_t value, uint64_t t) {
+        v = value;
+        return filter.shouldSend(&v, t);
+    };
+
+    ChangeFilter deadband(1, 5, 1000);
+    failures += expect(send(deadband, 100, 0), "the first value is sent");
+    failures += expect(!send(deadband, 103, 100), "a move within the deadband is suppressed");
+    failures += expect(send(deadband, 106, 200), "a move past the deadband is sent");
+    failures += expect(!send(deadband, 106, 1199), "an unchanged value is held until the keyframe");
+    failures += expect(send(deadband, 106, 1200), "an unchanged value is resent at the keyframe");
+    failures += expect(!send(deadband, 106, 500), "a timestamp stepping back does not force a keyframe");
+    failures += expect(!send(deadband, 106, 1499), "the keyframe interval restarts after a step back");
+    failures += expect(send(deadband, 106, 1500), "keyframes resume one interval after a step back");
+    failures += expect(deadband.suppressedCount() == 4, "suppressed values are counted");
+
+    ChangeFilter any(1, 0, 0);
+    failures += expect(send(any, 100, 0) && !send(any, 100, 1000000000) && send(any, 101, 1000000001),
+                       "deadband 0 sends every change and no keyframes");
+    ChangeFilter every(1, -1, 0);
+    failures += expect(send(every, 100, 0) && send(every, 100, 1), "a negative deadband sends every value");
+    return failures;
+}
+
+int checkDecimator() {
+    int failures = 0;
+    MPR121Sample data;
+    memset(&data, 0, sizeof(data));
+    std::vector<uint16_t> frames;
+
+    // Feed one tick the way the sender does: a stale window is finished
+    // before the sample that starts a later one
+    auto feed = [&](Decimator& dec, uint64_t seq, uint16_t value) {
+        for (int i = 0; i < MPR121_NCHANNELS; ++i) data.filtered[i] = value;
+        if (dec.finishStale(0, seq)) frames.push_back(dec.frame(0)[0]);
+        if (dec.update(0, data, seq, seq * 1000)) frames.push_back(dec.frame(0)[0]);
+    };
+
+    Decimator mean(1, 5, DECIMATE_MINMAX, std::vector<float>());
+    for (uint64_t seq = 0; seq < 4; ++seq) feed(mean, seq, 10 * (seq + 1));
+    feed(mean, 5, 100);
+    failures += expect(frames.size() == 1 && frames[0] == 25,
+                       "a window whose last tick was skipped is emitted by the next sample");
+    failures += expect(mean.frameMin(0)[0] == 10 && mean.frameMax(0)[0] == 40, "its extremes cover what it had");
+    for (uint64_t seq = 6; seq < 10; ++seq) feed(mean, seq, 100);
+    feed(mean, 10, 60);
+    feed(mean, 11, 80);
+    feed(mean, 30, 100);
+    failures += expect(frames.size() == 3 && frames[1] == 100 && frames[2] == 70,
+                       "a window cut short by a long gap averages what it had");
+
+    frames.clear();
+    std::vector<float> taps(3, 1.0f);
+    Decimator fir(1, 5, DECIMATE_FIR, taps);
+    for (uint64_t seq = 0; seq < 10; ++seq) feed(fir, seq, 100);
+    failures += expect(frames.size() == 2 && frames[0] == 100 && frames[1] == 100, "FIR frames once its history is full");
+    feed(fir, 14, 200);
+    failures += expect(frames.size() == 2, "a gap as long as the FIR clears its history");
+    for (uint64_t seq = 15; seq < 20; ++seq) feed(fir, seq, 200);
+    failures += expect(frames.size() == 3 && frames[2] == 200, "the refilled FIR holds only samples after the gap");
+    for (uint64_t seq = 20; seq < 29; ++seq) {
+        if (seq != 23) feed(fir, seq, 300);
+    }
+    feed(fir, 30, 400);
+    failures += expect(frames.size() == 5 && frames[3] == 300 && frames[4] == 300,
+                       "a short gap and a skipped last tick still give every FIR frame");
+    return failures;
+}
+
+int selfCheck(const std::string& name) {
+    int failures;
+    if (name == "ring") {
+        failures = checkRing();
+    } else if (name == "spool") {
+        failures = checkSpool();
+    } else if (name == "filter") {
+        failures = checkChangeFilter();
+    } else if (name == "decimate") {
+        failures = checkDecimator();
+    } else {
+        std::cerr << "Error: Unknown check '" << name << "' (expected ring, spool, filter or decimate)" << std::endl;
+        return 1;
+    }
+    std::cout << name << ": " << (failures == 0 ? "ok" : "FAILED") << std::endl;
+    return failures > 0;
+}
+
+int main(int argc, char* argv[]) {
+    std::string server_address = DEFAULT_DATASERVER_ADDRESS;
+    int server_port = DSERV_PORT;
+    int timer_interval_ms = DEFAULT_TIMER_INTERVAL_MS;
+    int coalesce_us = -1;
+    bool compact = false;
+    bool bus_windows = false;
+    bool realtime = false;
+    int rt_priority = 0;
+    int stats_interval = 0;
+    bool publish_stats = false;
+    bool simulate = false;
+    SimOptions sim_options;
+    int peer_timeout_ms = PEER_TIMEOUT_MS;
+    long spool_capacity = 0;
+    std::string spool_file;
+    int spool_rate = DEFAULT_SPOOL_RATE;
+    int deadband = -1;
+    int keyframe_ms = -1;
+    std::vector<std::pair<int, uint16_t>> channel_specs;
+    bool send_baseline = false;
+    bool send_delta = false;
+    int decimate = 1;
+    int decimate_filter = -1;
+    std::vector<float> fir_taps;
+    struct MirrorSpec {
+        std::string host;
+        int port;
+        OverflowPolicy policy;
+    };
+    std::vector<MirrorSpec> mirrors;
+    std::string udp_host;
+    int udp_port = DSERV_PORT;
+    int udp_ttl = 1;
+    int idle_interval_ms = 0;
+    int burst_hold_ms = DEFAULT_BURST_HOLD_MS;
+    int wake_delta = DEFAULT_WAKE_DELTA;
+    bool host_touch = false;
+    int touch_threshold = DEFAULT_TOUCH_THRESHOLD;
+    int release_threshold = DEFAULT_RELEASE_THRESHOLD;
+    int touch_debounce = DEFAULT_TOUCH_DEBOUNCE;
+    std::vector<std::vector<int> > electrode_thresholds;   // {sensor, electrode, touch, release}
+    SensorGroup group;
+    
+    // Parse command line arguments
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        
+        if (arg == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else if (arg == "--bench-pack") {
+            long count = 10000000;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                count = std::atol(argv[++i]);
+                if (count < 1) {
+                    std::cerr << "Error: --bench-pack count must be at least 1" << std::endl;
+                    return 1;
+                }
+            }
+            return benchmarkPacking(count);
+        }
+        else if (arg == "--self-check") {
+            if (i + 1 < argc) {
+                return selfCheck(argv[++i]);
+            }
+            std::cerr << "Error: " << arg << " requires a check name" << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+        else if (arg == "-h" || arg == "--host") {
+            if (i + 1 < argc) {
+                server_address = argv[++i];
+            } else {
+                std::cerr << "Error: " << arg << " requires an address argument" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "-p" || arg == "--port") {
+            if (i + 1 < argc) {
+                server_port = std::atoi(argv[++i]);
+                if (server_port <= 0 || server_port > 65535) {
+                    std::cerr << "Error: Invalid port number" << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: " << arg << " requires a port argument" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "-t" || arg == "--timer") {
+            if (i + 1 < argc) {
+                timer_interval_ms = std::atoi(argv[++i]);
+                if (timer_interval_ms <= 0 || timer_interval_ms > 10000) {
+                    std::cerr << "Error: Timer interval must be between 1-10000 ms" << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: " << arg << " requires a timer interval in milliseconds" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "-d" || arg == "--device") {
+            std::string device;
+            uint8_t addr;
+            if (i + 1 < argc) {
+                if (!parseDeviceSpec(argv[++i], device, addr)) {
+                    std::cerr << "Error: Invalid device '" << argv[i] << "' (expected <bus>:<0x5A-0x5D>)" << std::endl;
+                    return 1;
+                }
+                if (group.hasDevice(device, addr)) {
+                    std::cerr << "Error: Device '" << argv[i] << "' is given more than once" << std::endl;
+                    return 1;
+                }
+                group.addDevice(device, addr);
+            } else {
+                std::cerr << "Error: " << arg << " requires a <bus>:<addr> argument" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--cpu") {
+            std::string device;
+            int cpu;
+            if (i + 1 < argc) {
+                if (!parseCpuSpec(argv[++i], device, cpu)) {
+                    std::cerr << "Error: Invalid CPU assignment '" << argv[i] << "' (expected <bus>:<core>)" << std::endl;
+                    return 1;
+                }
+                group.setBusCpu(device, cpu);
+            } else {
+                std::cerr << "Error: " << arg << " requires a <bus>:<core> argument" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--overflow") {
+            if (i + 1 < argc) {
+                std::string policy = argv[++i];
+                if (policy == "drop-oldest") {
+                    group.setOverflowPolicy(DROP_OLDEST);
+                } else if (policy == "drop-newest") {
+                    group.setOverflowPolicy(DROP_NEWEST);
+                } else {
+                    std::cerr << "Error: Unknown overflow policy " << policy << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: " << arg << " requires a policy argument" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--mirror") {
+            if (i + 1 < argc) {
+                MirrorSpec mirror = { "", DSERV_PORT, DROP_OLDEST };
+                if (!parseDestinationSpec(argv[++i], mirror.host, mirror.port, mirror.policy)) {
+                    std::cerr << "Error: Invalid mirror '" << argv[i]
+                              << "' (expected host[:port][,drop-oldest|drop-newest])" << std::endl;
+                    return 1;
+                }
+                mirrors.push_back(mirror);
+            } else {
+                std::cerr << "Error: " << arg << " requires a destination" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--udp") {
+            OverflowPolicy unused = DROP_NEWEST;
+            std::string spec = i + 1 < argc ? argv[++i] : "";
+            if (spec.find(',') != std::string::npos ||
+                !parseDestinationSpec(spec, udp_host, udp_port, unused)) {
+                std::cerr << "Error: " << arg << " requires a destination host[:port]" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--udp-ttl") {
+            if (i + 1 < argc) {
+                udp_ttl = std::atoi(argv[++i]);
+                if (udp_ttl < 1 || udp_ttl > 255) {
+                    std::cerr << "Error: UDP multicast TTL must be between 1-255" << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: " << arg << " requires a hop count" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--host-touch") {
+            host_touch = true;
+        }
+        else if (arg == "--touch-threshold") {
+            if (i + 1 < argc) {
+                int sensor, electrode, touch, release;
+                if (!parseThresholdSpec(argv[++i], sensor, electrode, touch, release)) {
+                    std::cerr << "Error: Invalid threshold '" << argv[i]
+                              << "' (expected [sensor:electrode:]touch:release, release <= touch)" << std::endl;
+                    return 1;
+                }
+                if (sensor < 0) {
+                    touch_threshold = touch;
+                    release_threshold = release;
+                } else {
+                    electrode_thresholds.push_back({ sensor, electrode, touch, release });
+                }
+                host_touch = true;
+            } else {
+                std::cerr << "Error: " << arg << " requires a threshold" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--debounce") {
+            if (i + 1 < argc) {
+                touch_debounce = std::atoi(argv[++i]);
+                if (touch_debounce < 1 || touch_debounce > 100) {
+                    std::cerr << "Error: Debounce must be between 1-100 samples" << std::endl;
+                    return 1;
+                }
+                host_touch = true;
+            } else {
+                std::cerr << "Error: " << arg << " requires a number of samples" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--deadband") {
+            if (i + 1 < argc) {
+                deadband = std::atoi(argv[++i]);
+                if (deadband < 0 || deadband > 1023) {
+                    std::cerr << "Error: Deadband must be between 0-1023 counts" << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: " << arg << " requires a value in counts" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--keyframe") {
+            if (i + 1 < argc) {
+                keyframe_ms = std::atoi(argv[++i]);
+                if (keyframe_ms < 0 || keyframe_ms > 3600000) {
+                    std::cerr << "Error: Keyframe interval must be between 0-3600000 ms" << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: " << arg << " requires an interval in milliseconds" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--channels") {
+            int sensor;
+            uint16_t mask;
+            if (i + 1 < argc && parseChannelSpec(argv[i + 1], sensor, mask)) {
+                channel_specs.push_back(std::make_pair(sensor, mask));
+                ++i;
+            } else {
+                std::cerr << "Error: " << arg << " requires a channel mask 0x1-0x1FFF, optionally "
+                          << "prefixed with <sensor>:" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
         }
-    }
-
-    // Electrode Configuration
-    if (readBlock(0x2B, 3, buf)) {
-        std::cout << "\nElectrode Config (0x2B–0x2D):\n";
-        std::cout << "  ECR (0x2B): 0x" << std::hex << (int)buf[0] << std::dec << " → " << (buf[0] & 0x0F) << " electrodes enabled\n";
-        std::cout << "  CDC (0x2C): " << (int)buf[1] << " (charge current)\n";
-        std::cout << "  CDT (0x2D): " << (int)buf[2] << " (charge time)\n";
-    }
-
-    // Thresholds
-    if (readBlock(0x41, 24, buf)) {
-        std::cout << "\nTouch/Release Thresholds (0x41–0x5A):\n";
-        for (int i = 0; i < 12; ++i) {
-            uint8_t touch = buf[i * 2];
-            uint8_t release = buf[i * 2 + 1];
-            std::cout << "  E" << i << ": Touch=" << (int)touch << ", Release=" << (int)release << "\n";
+        else if (arg == "--baseline") {
+            send_baseline = true;
         }
-    }
-
-    // Filter & Autoconfig
-    if (readBlock(0x5B, 4, buf)) {
-        std::cout << "\nFilter/Debounce/Autoconfig (0x5B–0x5E):\n";
-        std::cout << "  Debounce (0x5B): " << (int)buf[0] << "\n";
-        std::cout << "  Filter Config (0x5C–0x5D): 0x" << std::hex << (int)buf[1] << " 0x" << (int)buf[2] << std::dec << "\n";
-        std::cout << "  Autoconfig (0x5E): " << (int)buf[3] << "\n";
-    }
-
-    std::cout << "\n";
-}
-
-void printUsage(const char* program_name) {
-    std::cout << "Usage: " << program_name << " [OPTIONS]\n"
-              << "Options:\n"
-              << "  -h, --host <address>    Dataserver host address (default: " << DEFAULT_DATASERVER_ADDRESS << ")\n"
-              << "  -p, --port <port>       Dataserver port (default: " << DSERV_PORT << ")\n"
-              << "  -t, --timer <ms>        Timer interval in milliseconds (default: " << DEFAULT_TIMER_INTERVAL_MS << ")\n"
-              << "  --help                  Show this help message\n"
-              << "\nExample:\n"
-              << "  " << program_name << " -h 192.168.1.100 -p 4620 -t 50\n"
-              << "  " << program_name << " --host server.local --timer 10  # 100Hz sampling\n"
-              << std::endl;
-}
-
-void signalHandler(int signal) {
-    std::cout << "\nReceived signal " << signal << ", shutting down..." << std::endl;
-    running.store(false);
-}
-
-int main(int argc, char* argv[]) {
-    std::string server_address = DEFAULT_DATASERVER_ADDRESS;
-    int server_port = DSERV_PORT;
-    int timer_interval_ms = DEFAULT_TIMER_INTERVAL_MS;
-    
-    // Parse command line arguments
-    for (int i = 1; i < argc; i++) {
-        std::string arg = argv[i];
-        
-        if (arg == "--help") {
-            printUsage(argv[0]);
-            return 0;
+        else if (arg == "--delta") {
+            send_delta = true;
         }
-        else if (arg == "-h" || arg == "--host") {
+        else if (arg == "--decimate") {
             if (i + 1 < argc) {
-                server_address = argv[++i];
+                decimate = std::atoi(argv[++i]);
+                if (decimate < 2 || decimate > 1000) {
+                    std::cerr << "Error: Decimation factor must be between 2-1000 ticks" << std::endl;
+                    return 1;
+                }
             } else {
-                std::cerr << "Error: " << arg << " requires an address argument" << std::endl;
+                std::cerr << "Error: " << arg << " requires a number of ticks per frame" << std::endl;
                 printUsage(argv[0]);
                 return 1;
             }
         }
-        else if (arg == "-p" || arg == "--port") {
+        else if (arg == "--decimate-filter") {
+            std::string name = i + 1 < argc ? argv[++i] : "";
+            if (name == "mean") {
+                decimate_filter = DECIMATE_MEAN;
+            } else if (name == "minmax") {
+                decimate_filter = DECIMATE_MINMAX;
+            } else if (name == "fir") {
+                decimate_filter = DECIMATE_FIR;
+            } else {
+                std::cerr << "Error: " << arg << " requires mean, minmax or fir" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--fir-taps") {
+            if (i + 1 < argc && parseTapList(argv[i + 1], fir_taps)) {
+                decimate_filter = DECIMATE_FIR;
+                ++i;
+            } else {
+                std::cerr << "Error: " << arg << " requires 1-" << DECIMATE_MAX_TAPS
+                          << " comma-separated coefficients with a nonzero sum" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--idle-interval") {
             if (i + 1 < argc) {
-                server_port = std::atoi(argv[++i]);
-                if (server_port <= 0 || server_port > 65535) {
-                    std::cerr << "Error: Invalid port number" << std::endl;
+                idle_interval_ms = std::atoi(argv[++i]);
+                if (idle_interval_ms <= 0 || idle_interval_ms > 10000) {
+                    std::cerr << "Error: Idle interval must be between 1-10000 ms" << std::endl;
                     return 1;
                 }
             } else {
-                std::cerr << "Error: " << arg << " requires a port argument" << std::endl;
+                std::cerr << "Error: " << arg << " requires an interval in milliseconds" << std::endl;
                 printUsage(argv[0]);
                 return 1;
             }
         }
-        else if (arg == "-t" || arg == "--timer") {
+        else if (arg == "--burst-hold") {
             if (i + 1 < argc) {
-                timer_interval_ms = std::atoi(argv[++i]);
-                if (timer_interval_ms <= 0 || timer_interval_ms > 10000) {
-                    std::cerr << "Error: Timer interval must be between 1-10000 ms" << std::endl;
+                burst_hold_ms = std::atoi(argv[++i]);
+                if (burst_hold_ms < 0 || burst_hold_ms > 3600000) {
+                    std::cerr << "Error: Burst hold must be between 0-3600000 ms" << std::endl;
                     return 1;
                 }
             } else {
-                std::cerr << "Error: " << arg << " requires a timer interval in milliseconds" << std::endl;
+                std::cerr << "Error: " << arg << " requires a time in milliseconds" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--wake-delta") {
+            if (i + 1 < argc) {
+                wake_delta = std::atoi(argv[++i]);
+                if (wake_delta < 1 || wake_delta > 1023) {
+                    std::cerr << "Error: Wake delta must be between 1-1023 counts" << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: " << arg << " requires a number of counts" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--coalesce") {
+            if (i + 1 < argc) {
+                coalesce_us = std::atoi(argv[++i]);
+                if (coalesce_us < 0 || coalesce_us > 1000000) {
+                    std::cerr << "Error: Coalescing delay must be between 0-1000000 us" << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: " << arg << " requires a delay in microseconds" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--clock") {
+            if (i + 1 < argc) {
+                std::string source = argv[++i];
+                if (source == "realtime") {
+                    group.clock().useTai(false);
+                } else if (source == "tai") {
+                    group.clock().useTai(true);
+                } else {
+                    std::cerr << "Error: Unknown clock " << source << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: " << arg << " requires a clock argument" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--bus-windows") {
+            bus_windows = true;
+        }
+        else if (arg == "--realtime") {
+            realtime = true;
+        }
+        else if (arg == "--rt-priority") {
+            if (i + 1 < argc) {
+                rt_priority = std::atoi(argv[++i]);
+                if (rt_priority < 1 || rt_priority > 99) {
+                    std::cerr << "Error: Real-time priority must be between 1-99" << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: " << arg << " requires a priority" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--stats-interval") {
+            if (i + 1 < argc) {
+                stats_interval = std::atoi(argv[++i]);
+                if (stats_interval < 1) {
+                    std::cerr << "Error: Statistics interval must be at least 1 second" << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: " << arg << " requires an interval in seconds" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--publish-stats") {
+            publish_stats = true;
+        }
+        else if (arg == "--sim") {
+            simulate = true;
+        }
+        else if (arg == "--sim-bus-hz" || arg == "--sim-latency" || arg == "--sim-nak") {
+            if (i + 1 < argc) {
+                simulate = true;
+                double value = std::atof(argv[++i]);
+                if (value < 0 || (arg == "--sim-nak" && value > 100)) {
+                    std::cerr << "Error: Invalid value for " << arg << std::endl;
+                    return 1;
+                }
+                if (arg == "--sim-bus-hz") sim_options.bus_hz = value;
+                else if (arg == "--sim-latency") sim_options.latency_us = value;
+                else sim_options.nak_rate = value / 100.0;
+            } else {
+                std::cerr << "Error: " << arg << " requires a value" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--spool") {
+            if (i + 1 < argc) {
+                spool_capacity = std::atol(argv[++i]);
+                if (spool_capacity < 1 || spool_capacity > 16 * 1024 * 1024) {
+                    std::cerr << "Error: Spool capacity must be between 1-16777216 datapoints" << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: " << arg << " requires a number of datapoints" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--spool-file") {
+            if (i + 1 < argc) {
+                spool_file = argv[++i];
+            } else {
+                std::cerr << "Error: " << arg << " requires a file path" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--spool-rate") {
+            if (i + 1 < argc) {
+                spool_rate = std::atoi(argv[++i]);
+                if (spool_rate < 100 || spool_rate > 1000000) {
+                    std::cerr << "Error: Spool replay rate must be between 100-1000000 datapoints/s" << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: " << arg << " requires a rate in datapoints per second" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--peer-timeout") {
+            if (i + 1 < argc) {
+                peer_timeout_ms = std::atoi(argv[++i]);
+                if (peer_timeout_ms < 1000 || peer_timeout_ms > 600000) {
+                    std::cerr << "Error: Peer timeout must be between 1000-600000 ms" << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: " << arg << " requires a timeout in milliseconds" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--compact") {
+            compact = true;
+        }
+        else if (arg == "--irq") {
+            std::string device, chip;
+            uint8_t addr;
+            unsigned int offset;
+            if (i + 1 < argc && parseIrqSpec(argv[i + 1], device, addr, chip, offset)) {
+                group.setIrqLine(device, addr, chip, offset);
+                ++i;
+            } else {
+                std::cerr << "Error: " << arg << " requires <bus:addr@chip:line>, e.g. 1:0x5A@0:17" << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--config") {
+            if (i + 1 < argc) {
+                if (!loadConfig(argv[++i], group)) {
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: " << arg << " requires a file argument" << std::endl;
                 printUsage(argv[0]);
                 return 1;
             }
@@ -542,140 +4799,367 @@ int main(int argc, char* argv[]) {
     
     // Create client with parsed arguments
     DataserverClient client(server_address, server_port);
+    for (const MirrorSpec& mirror : mirrors) {
+        client.addDestination(mirror.host, mirror.port, mirror.policy);
+    }
+    if (!udp_host.empty()) {
+        if (!client.setDatagramDestination(udp_host, udp_port, udp_ttl)) {
+            return 1;
+        }
+        std::cout << "Sending vals over UDP to " << udp_host << ":" << udp_port << std::endl;
+    }
+    client.setCoalesceDelay(coalesce_us);
+    client.setCompact(compact);
+    client.setClock(&group.clock());
+    client.setPeerTimeout(peer_timeout_ms);
+    if (keyframe_ms < 0) {
+        keyframe_ms = deadband >= 0 ? DEFAULT_KEYFRAME_MS : 0;
+    }
+    if (decimate_filter >= 0 && decimate == 1) {
+        std::cerr << "Error: --decimate-filter and --fir-taps require --decimate" << std::endl;
+        return 1;
+    }
+    if (decimate_filter < 0) {
+        decimate_filter = DECIMATE_MEAN;
+    }
+    if (idle_interval_ms > 0) {
+        if (idle_interval_ms <= timer_interval_ms || idle_interval_ms % timer_interval_ms != 0) {
+            std::cerr << "Error: --idle-interval must be a multiple of the " << timer_interval_ms
+                      << " ms timer interval" << std::endl;
+            return 1;
+        }
+        // Decimation windows assume one sample per tick
+        if (decimate > 1) {
+            std::cerr << "Error: --idle-interval cannot be combined with --decimate" << std::endl;
+            return 1;
+        }
+    }
+    if (spool_capacity > 0 || !spool_file.empty()) {
+        if (spool_capacity == 0) {
+            spool_capacity = DEFAULT_SPOOL_CAPACITY;
+        }
+        if (!client.setSpool(spool_capacity, spool_file, spool_rate)) {
+            return 1;
+        }
+        std::cout << "Spooling up to " << spool_capacity << " datapoints"
+                  << (spool_file.empty() ? "" : " in " + spool_file) << std::endl;
+    }
     // Setup signal handlers
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
+    signal(SIGUSR1, statsSignalHandler);
     
     std::cout << "Starting MPR121 Data Forwarder for Raspberry Pi" << std::endl;
     std::cout << "Target server: " << server_address << ":" << server_port << std::endl;
     std::cout << "Sample rate: " << (1000.0 / timer_interval_ms) << " Hz (" << timer_interval_ms << "ms interval)" << std::endl;
-    
-    // Initialize MPR121 sensors
-    if (!cap0.begin()) {
-        std::cerr << "MPR121 sensor 0 (0x5A) not found!" << std::endl;
-        return 1;
+    if (idle_interval_ms > 0) {
+        std::cout << "Idle rate: " << (1000.0 / idle_interval_ms) << " Hz (" << idle_interval_ms
+                  << "ms interval), bursting for " << burst_hold_ms << "ms after activity" << std::endl;
     }
-    std::cout << "MPR121[0] found!" << std::endl;
     
-    if (!cap1.begin()) {
-        std::cerr << "MPR121 sensor 1 (0x5B) not found!" << std::endl;
-        return 1;
+    // Default rig: two sensors on /dev/i2c-1
+    if (group.size() == 0) {
+        group.addDevice("/dev/i2c-1", 0x5A);
+        group.addDevice("/dev/i2c-1", 0x5B);
+    }
+
+    // Each device reads only as far as the registers its streams need; the
+    // host touch detector needs every electrode
+    std::vector<ChannelMap> channel_maps(group.size());
+    for (const auto& spec : channel_specs) {
+        if (spec.first >= (int)group.size()) {
+            std::cerr << "Error: No sensor " << spec.first << " for --channels" << std::endl;
+            return 1;
+        }
+        for (size_t id = 0; id < group.size(); ++id) {
+            if (spec.first < 0 || spec.first == (int)id) channel_maps[id] = ChannelMap(spec.second);
+        }
+    }
+    for (size_t id = 0; id < group.size(); ++id) {
+        uint16_t read_mask = channel_maps[id].mask() | (host_touch ? 0x0FFF : 0);
+        group.setChannels(id, read_mask, send_baseline || send_delta || idle_interval_ms > 0);
+    }
+    if (idle_interval_ms > 0) {
+        group.setAdaptiveRate(idle_interval_ms / timer_interval_ms,
+                              (burst_hold_ms + timer_interval_ms - 1) / timer_interval_ms, wake_delta);
+    }
+
+    if (simulate) {
+        group.setSimulated(sim_options);
+        std::cout << "Using simulated MPR121 devices" << std::endl;
     }
-    std::cout << "MPR121[1] found!" << std::endl;
-    
-    // Start reconnection loop
-    client.startReconnectLoop();
     
-    // Create timer for periodic readings
-    int timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
-    if (timer_fd < 0) {
-        std::cerr << "Failed to create timer: " << strerror(errno) << std::endl;
+    // Initialize MPR121 sensors
+    if (!group.begin()) {
         return 1;
     }
     
-    struct itimerspec timer_spec;
-    timer_spec.it_value.tv_sec = 0;
-    timer_spec.it_value.tv_nsec = timer_interval_ms * 1000000; // Convert ms to ns
-    timer_spec.it_interval.tv_sec = 0;
-    timer_spec.it_interval.tv_nsec = timer_interval_ms * 1000000;
+    // --rt-priority implies --realtime, in either order
+    if (realtime && rt_priority == 0) {
+        rt_priority = RT_DEFAULT_PRIORITY;
+    }
+    if (rt_priority > 0) {
+        group.setRealtime(rt_priority);
+        std::cout << "Real-time mode: SCHED_FIFO priority " << rt_priority << std::endl;
+    }
     
-    if (timerfd_settime(timer_fd, 0, &timer_spec, NULL) < 0) {
-        std::cerr << "Failed to set timer: " << strerror(errno) << std::endl;
-        close(timer_fd);
+    // Start the network event loop
+    if (!client.start()) {
         return 1;
     }
     
+    std::unique_ptr<HostTouchDetector> detector;
+    if (host_touch) {
+        detector.reset(new HostTouchDetector(group.size(), touch_threshold, release_threshold, touch_debounce));
+        for (const std::vector<int>& t : electrode_thresholds) {
+            if (!detector->setThresholds(t[0], t[1], t[2], t[3])) {
+                std::cerr << "Error: No sensor " << t[0] << " for --touch-threshold" << std::endl;
+                return 1;
+            }
+        }
+    }
+
     // Tracking variables
-    uint16_t last_touched0 = 0;
-    uint16_t last_touched1 = 0;
-    
-    const char* sensor0_touched_point = "grasp/sensor0/touched";
-    const char* sensor0_vals_point = "grasp/sensor0/vals";
-    const char* sensor1_touched_point = "grasp/sensor1/touched";
-    const char* sensor1_vals_point = "grasp/sensor1/vals";
-    
-    std::cout << "Registers for sensor 0" << std::endl;
-    dumpMPR121(cap0.get_fd());
+    uint64_t keyframe_us = (uint64_t)keyframe_ms * 1000;
+    std::vector<ChangeFilter> touched_filters(group.size(), ChangeFilter(1, 0, keyframe_us));
+    std::vector<ChangeFilter> vals_filters;
+    for (size_t id = 0; id < group.size(); ++id) {
+        vals_filters.push_back(ChangeFilter(channel_maps[id].count(), deadband, keyframe_us));
+    }
+    std::vector<uint64_t> next_seq(group.size(), 0);
+    std::vector<ChangeFilter> host_touched_filters(group.size(), ChangeFilter(1, 0, keyframe_us));
+    std::unique_ptr<Decimator> decimator;
+    if (decimate > 1) {
+        decimator.reset(new Decimator(group.size(), decimate, (DecimateFilter)decimate_filter, fir_taps));
+        std::cout << "Forwarding vals at " << (1000.0 / (timer_interval_ms * decimate)) << " Hz ("
+                  << (decimate_filter == DECIMATE_FIR ? std::to_string(decimator->tapCount()) + "-tap FIR" :
+                      decimate_filter == DECIMATE_MINMAX ? "mean/min/max" : "mean")
+                  << " over " << decimate << " ticks)" << std::endl;
+    }
+    // Datapoint descriptors, built once so each send only patches in the
+    // timestamp and payload
+    std::vector<Datapoint> touched_points, host_touched_points, vals_points, window_points, gap_points;
+    std::vector<Datapoint> vals_min_points, vals_max_points, status_points, baseline_points, delta_points;
+    std::vector<Datapoint> rate_points;
+    for (size_t id = 0; id < group.size(); ++id) {
+        std::string prefix = "grasp/sensor" + std::to_string(id);
+        gap_points.push_back(Datapoint(prefix + "/seqgap", DSERV_INT, 2 * sizeof(int32_t)));
+        status_points.push_back(Datapoint(prefix + "/status", DSERV_INT, 2 * sizeof(int32_t)));
+        rate_points.push_back(Datapoint(prefix + "/rate", DSERV_FLOAT, sizeof(float)));
+        touched_points.push_back(Datapoint(prefix + "/touched", DSERV_SHORT, sizeof(uint16_t)));
+        host_touched_points.push_back(Datapoint(prefix + "/hosttouched", DSERV_SHORT, sizeof(uint16_t)));
+        size_t channels = channel_maps[id].count();
+        vals_points.push_back(Datapoint(prefix + "/vals", DSERV_SHORT, channels * sizeof(uint16_t)));
+        vals_min_points.push_back(Datapoint(prefix + "/vals_min", DSERV_SHORT, channels * sizeof(uint16_t)));
+        vals_max_points.push_back(Datapoint(prefix + "/vals_max", DSERV_SHORT, channels * sizeof(uint16_t)));
+        baseline_points.push_back(Datapoint(prefix + "/baseline", DSERV_SHORT, channels * sizeof(uint16_t)));
+        delta_points.push_back(Datapoint(prefix + "/delta", DSERV_INT, channels * sizeof(int32_t)));
+        window_points.push_back(Datapoint(prefix + "/i2c_window", DSERV_INT, sizeof(int32_t)));
+    }
     
-    std::cout << "Registers for sensor 1" << std::endl;
-    dumpMPR121(cap1.get_fd());
+    for (size_t id = 0; id < group.size(); ++id) {
+        if (!group.isUp(id)) continue;
+        std::cout << "Registers for sensor " << id << std::endl;
+        dumpMPR121(*group.sensor(id));
+    }
     
+    SampleClock& clock = group.clock();
     
-    std::cout << "Starting data collection loop..." << std::endl;
+    // Acquisition to hand-off to the socket, per sample; under batching
+    // samples wait in batch_starts until their batch is flushed
+    Histogram end_to_end;
+    std::vector<uint64_t> batch_starts;
     
-    while (running.load()) {
-        // Wait for timer to expire
-        uint64_t timer_expirations;
-        ssize_t bytes_read = read(timer_fd, &timer_expirations, sizeof(timer_expirations));
-        
-        if (bytes_read < 0) {
-            if (errno == EINTR) continue; // Interrupted by signal
-            std::cerr << "Timer read error: " << strerror(errno) << std::endl;
-            break;
-        }
+    // vals and their min/max frames go over UDP with --udp, else with the rest
+    auto sendVals = [&](const Datapoint& point, const void* vals, uint64_t timestamp) {
+        return client.hasDatagramDestination() ? client.sendDatagram(point, vals, timestamp)
+                                               : client.writeToDataserver(point, vals, timestamp);
+    };
 
-        // Check touch status changes
-        uint16_t curr_touched0 = cap0.touched();
-        if (curr_touched0 != last_touched0) {
-            if (client.isConnected() && client.testConnection()) {
-                client.writeToDataserver(sensor0_touched_point, DSERV_SHORT, 
-                                       sizeof(uint16_t), &curr_touched0);
+    // Send one vals frame: the sample's own filtered data, or a decimated
+    // frame when frame_row is given. With --udp they go out as datagrams,
+    // which are never batched; with --deadband only on change.
+    auto sendFrame = [&](const DeviceSample& sample, const uint16_t* frame_row, uint64_t vals_timestamp) {
+        const ChannelMap& channels = channel_maps[sample.sensor];
+        uint16_t filtered_data[MPR121_NCHANNELS], baseline[MPR121_NCHANNELS];
+        int32_t delta[MPR121_NCHANNELS];
+        channels.unpack(sample.data, frame_row, filtered_data, baseline, delta);
+        if (!vals_filters[sample.sensor].shouldSend(filtered_data, vals_timestamp)) {
+            return;
+        }
+        if (sendVals(vals_points[sample.sensor], filtered_data, vals_timestamp)) {
+            if (!client.hasDatagramDestination() && client.isBatching()) {
+                batch_starts.push_back(sample.read_start);
+            } else {
+                end_to_end.record(clock.now() - sample.read_start);
             }
-            last_touched0 = curr_touched0;
         }
-        
-        uint16_t curr_touched1 = cap1.touched();
-        if (curr_touched1 != last_touched1) {
-            if (client.isConnected() && client.testConnection()) {
-                client.writeToDataserver(sensor1_touched_point, DSERV_SHORT,
-                                       sizeof(uint16_t), &curr_touched1);
+        if (decimate_filter == DECIMATE_MINMAX && decimator) {
+            uint16_t extreme[MPR121_NCHANNELS];
+            channels.gather(decimator->frameMin(sample.sensor), extreme);
+            sendVals(vals_min_points[sample.sensor], extreme, vals_timestamp);
+            channels.gather(decimator->frameMax(sample.sensor), extreme);
+            sendVals(vals_max_points[sample.sensor], extreme, vals_timestamp);
+        }
+        // Baselines and deltas travel with vals; deltas are taken
+        // against the frame when decimating
+        if (send_baseline) {
+            sendVals(baseline_points[sample.sensor], baseline, vals_timestamp);
+        }
+        if (send_delta) {
+            sendVals(delta_points[sample.sensor], delta, vals_timestamp);
+        }
+        //            printDebugOutput(*group.sensor(sample.sensor), sample.sensor, filtered_data, channels.count());
+    };
+
+    // Runs on the sender thread only, so the client is never shared
+    auto handleSample = [&](const DeviceSample& sample) {
+        const MPR121Sample& data = sample.data;
+        uint64_t timestamp = clock.toMicros(sample.midpoint());
+
+        // An IRQ status read carries only the touch status; send a change
+        // straight away, ahead of any batch
+        if (sample.kind == SAMPLE_IRQ) {
+            uint16_t touched = data.touched;
+            if (touched_filters[sample.sensor].shouldSend(&touched, timestamp)) {
+                client.writeToDataserver(touched_points[sample.sensor], &touched, timestamp);
+                client.flush();
             }
-            last_touched1 = curr_touched1;
+            return;
+        }
+
+        // A device dropped out or came back: {1 up / 0 quarantined, dropouts
+        // so far}. Its missing ticks show up as a seqgap once it is back.
+        if (sample.kind == SAMPLE_HEALTH) {
+            int32_t status[2] = { sample.up, (int32_t)sample.dropouts };
+            client.writeToDataserver(status_points[sample.sensor], status, timestamp);
+            return;
         }
 
-        // Send filtered data periodically (and test connection)
-        if (client.testConnection()) {
-            uint16_t filtered_data[NSENSORS];
-	    uint8_t rawData[16];
+        // The bus switched between its idle and burst rates: publish the
+        // new sample rate in Hz
+        if (sample.kind == SAMPLE_RATE) {
+            float rate = 1000.0f / (timer_interval_ms * sample.stride);
+            client.writeToDataserver(rate_points[sample.sensor], &rate, timestamp);
+            return;
+        }
+
+        // Ticks skipped by the scheduler or dropped from the ring show up as
+        // a jump in sequence numbers: publish {first missing seq, count}.
+        // Ticks an idle bus leaves out on purpose are covered by the stride.
+        uint64_t expected = next_seq[sample.sensor];
+        if (sample.seq + 1 > expected + sample.stride) {
+            int32_t gap[2] = { (int32_t)expected, (int32_t)(sample.seq + 1 - sample.stride - expected) };
+            client.writeToDataserver(gap_points[sample.sensor], gap, timestamp);
+        }
+        next_seq[sample.sensor] = sample.seq + 1;
 
-	    if (!cap0.readRegisters(0x04, rawData, sizeof(rawData))) {
-	      std::cerr << "Failed to read raw data\n";
-	      break;
-	    }
+        // Check touch status changes. While disconnected the client either
+        // spools these or drops them at once.
+        uint16_t touched = data.touched;
+        if (touched_filters[sample.sensor].shouldSend(&touched, timestamp)) {
+            client.writeToDataserver(touched_points[sample.sensor], &touched, timestamp);
+        }
 
-	    for (int i = 0; i < 12; i+=2) {
-	      filtered_data[i/2] = rawData[i+4] | (rawData[i+1+4] << 8);
-	    }
+        // Host-side touch decision from the same filtered data
+        if (detector) {
+            uint16_t host_touched = detector->update(sample.sensor, data);
+            if (host_touched_filters[sample.sensor].shouldSend(&host_touched, timestamp)) {
+                client.writeToDataserver(host_touched_points[sample.sensor], &host_touched, timestamp);
+            }
+        }
 
-            client.writeToDataserver(sensor0_vals_point, DSERV_SHORT,
-                                   NSENSORS * sizeof(uint16_t), filtered_data);
-            
-	    //            printDebugOutput(cap0, 0, filtered_data);
+        // Send filtered data every tick, or one filtered frame per window
+        // with --decimate
+        if (decimator) {
+            if (decimator->finishStale(sample.sensor, sample.seq)) {
+                sendFrame(sample, decimator->frame(sample.sensor), decimator->frameTimestamp(sample.sensor));
+            }
+            if (decimator->update(sample.sensor, data, sample.seq, timestamp)) {
+                sendFrame(sample, decimator->frame(sample.sensor), decimator->frameTimestamp(sample.sensor));
+            }
+        } else {
+            sendFrame(sample, nullptr, timestamp);
+        }
 
-            // Get sensor 1 data
-	    if (!cap1.readRegisters(0x04, rawData, sizeof(rawData))) {
-	      std::cerr << "Failed to read raw data\n";
-	      break;
-	    }
-	    
-	    for (int i = 0; i < 12; i+=2) {
-	      filtered_data[i/2] = rawData[i+4] | (rawData[i+1+4] << 8);
-	    }
+        // Bus transaction window: stamped at its start, lasting data ns
+        if (bus_windows) {
+            int32_t duration = sample.read_end - sample.read_start;
+            client.writeToDataserver(window_points[sample.sensor], &duration, clock.toMicros(sample.read_start));
+        }
+    };
+    
+    std::cout << "Starting data collection loop..." << std::endl;
+    
+    if (!group.start(timer_interval_ms)) {
+        return 1;
+    }
+    
+    // Sender thread: drain the sample rings so a stalled send() never holds
+    // up the bus threads
+    std::atomic<bool> sending(true);
+    std::thread sender([&]() {
+        DeviceSample sample;
+        auto next_stats = std::chrono::steady_clock::now() + std::chrono::seconds(stats_interval);
+        while (sending.load()) {
+            group.waitForSamples(client.batchTimeout(100000));
+            clock.calibrateIfDue();
+            while (group.pop(sample)) {
+                handleSample(sample);
+            }
+            client.flushIfDue();
+            if (!client.batchPending() && !batch_starts.empty()) {
+                uint64_t now = clock.now();
+                for (uint64_t start : batch_starts) {
+                    end_to_end.record(now - start);
+                }
+                batch_starts.clear();
+            }
 
-            client.writeToDataserver(sensor1_vals_point, DSERV_SHORT,
-                                   NSENSORS * sizeof(uint16_t), filtered_data);
-                                   
-	    //            printDebugOutput(cap1, 1, filtered_data);                       
+            bool interval_due = stats_interval > 0 && std::chrono::steady_clock::now() >= next_stats;
+            if (stats_requested.exchange(false) || interval_due) {
+                printStats(std::cout, group, client, end_to_end);
+                if (publish_stats && client.isConnected()) {
+                    publishStats(group, client, end_to_end);
+                }
+                if (interval_due) {
+                    next_stats += std::chrono::seconds(stats_interval);
+                }
+            }
         }
+        client.flush();
+    });
+
+    // Real-time mode: lock memory only once every long-lived thread exists.
+    // MCL_FUTURE would charge each later thread stack to RLIMIT_MEMLOCK, and
+    // without MCL_ONFAULT every 8 MB stack would be pinned whole, so neither
+    // is used: resident pages, including the stacks and rings the bus threads
+    // pre-fault, are locked, and so is anything later faulted into them.
+    if (rt_priority > 0 && mlockall(MCL_CURRENT | MCL_ONFAULT) < 0) {
+        std::cerr << "Warning: mlockall failed (" << strerror(errno)
+                  << "), memory will not be locked" << std::endl;
+    }
+    
+    while (running.load() && !group.hasFailed()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
     
     std::cout << "Cleaning up..." << std::endl;
     
     // Cleanup
-    close(timer_fd);
-    client.stopReconnectLoop();
-    client.disconnect();
+    group.stop();
+    sending.store(false);
+    sender.join();
+    client.stop();
     
+    printStats(std::cout, group, client, end_to_end);
+    if (deadband >= 0) {
+        uint64_t suppressed = 0;
+        for (const ChangeFilter& filter : vals_filters) {
+            suppressed += filter.suppressedCount();
+        }
+        std::cout << "Deadband suppressed " << suppressed << " vals datapoints" << std::endl;
+    }
     std::cout << "Shutdown complete." << std::endl;
     return 0;
 }